@@ -0,0 +1,95 @@
+#include "BiosImage.h"
+#include "Bus.h"
+#include <mutex>
+#include <unordered_map>
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static std::mutex images_mutex;
+static std::unordered_map<std::string, std::weak_ptr<BiosImage>> images; //by path
+
+BiosImage::~BiosImage()
+{
+	if (data == nullptr)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, BIOS_SIZE);
+#endif
+}
+
+std::shared_ptr<BiosImage> BiosImage::open(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(images_mutex);
+
+	//still mapped by another instance
+	std::shared_ptr<BiosImage> image = images[path].lock();
+	if (image != nullptr)
+		return image;
+
+	image.reset(new BiosImage());
+	if (!image->map(path))
+		return nullptr;
+
+	printf("Original bios loaded\n");
+	images[path] = image;
+	return image;
+}
+
+bool BiosImage::map(const std::string& path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cerr << "!!Bios file: " + path + " failed to open!!\n";
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart != BIOS_SIZE) {
+		std::cerr << "!!Bios size does not match original size!!\n";
+		CloseHandle(file);
+		return false;
+	}
+
+	//the view keeps the file mapped once both handles are closed
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr) {
+		data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, BIOS_SIZE);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	s32 fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "!!Bios file: " + path + " failed to open!!\n";
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size != BIOS_SIZE) {
+		std::cerr << "!!Bios size does not match original size!!\n";
+		close(fd);
+		return false;
+	}
+
+	//the mapping keeps the file open
+	void* memory = mmap(nullptr, BIOS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (memory != MAP_FAILED)
+		data = (const u8*)memory;
+	close(fd);
+#endif
+
+	if (data == nullptr) {
+		std::cerr << "!!Bios file: " + path + " failed to map!!\n";
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
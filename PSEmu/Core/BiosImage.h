@@ -0,0 +1,18 @@
+#pragma once
+#include "Common.h"
+#include <memory>
+
+//A bios file mapped read only. Every Bus in the process that loads the same
+//path shares one mapping, the file is validated when it is first mapped
+struct BiosImage {
+	~BiosImage();
+
+	//nullptr when the file is missing or not a bios
+	static std::shared_ptr<BiosImage> open(const std::string& path);
+
+	const u8* data = nullptr;
+
+private:
+	BiosImage() = default;
+	bool map(const std::string& path);
+};
\ No newline at end of file
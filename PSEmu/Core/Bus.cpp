@@ -1,133 +1,595 @@
 #include "Bus.h"
+#include "CodeCache.h"
+#include "BiosImage.h"
+#include <algorithm>
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static_assert(ARENA_BIOS + BIOS_SIZE <= ARENA_SIZE, "guest memory does not fit the arena");
 
 Bus::Bus()
 {
+	allocate_arena();
+	main_ram = arena + ARENA_MAIN_RAM;
+	expansion_region_1 = arena + ARENA_EXPANSION_REGION_1;
+	scratchpad = arena + ARENA_SCRATCHPAD;
+	io_ports = arena + ARENA_IO_PORTS;
+	bios_rom = arena + ARENA_BIOS;
+	mmio.set_latch(io_ports);
+	map_mmio(0x1F801000, 0x24, MMIO_WIDTH_8 | MMIO_POLLABLE, &Bus::memory_control_read, &Bus::memory_control_write<u8>, this);
+	map_mmio(0x1F801000, 0x24, MMIO_WIDTH_16 | MMIO_POLLABLE, &Bus::memory_control_read, &Bus::memory_control_write<u16>, this);
+	map_mmio(0x1F801000, 0x24, MMIO_WIDTH_32 | MMIO_POLLABLE, &Bus::memory_control_read, &Bus::memory_control_write<u32>, this);
+	map_mmio(INTERRUPT_STATUS, 8, MMIO_WIDTH_16 | MMIO_WIDTH_32 | MMIO_POLLABLE,
+		&InterruptController::read, &InterruptController::write, &interrupts);
+
+	read_pages.resize(MEMORY_PAGE_COUNT, nullptr);
+	write_pages.resize(MEMORY_PAGE_COUNT, nullptr);
+	map_memory();
 	reset();
 }
 
 Bus::~Bus()
 {
-	if (bios_rom != nullptr) delete bios_rom;
-	if (main_ram != nullptr) delete main_ram;
-	if (expansion_region_1 != nullptr) delete expansion_region_1;
-	if (scratchpad != nullptr) delete scratchpad;
-	if (io_ports != nullptr) delete io_ports;
+	if (tracer != nullptr)
+		tracer->set_generation(nullptr);
+#if defined(_WIN32)
+	VirtualFree(arena, 0, MEM_RELEASE);
+#else
+	munmap(arena, ARENA_SIZE);
+#if defined(BUS_FASTMEM)
+	if (fastmem_base != nullptr)
+		munmap(fastmem_base, FASTMEM_ARENA_SIZE);
+#endif
+#endif
 }
 
-void Bus::reset()
+void Bus::allocate_arena()
 {
-	main_ram = nullptr;
-	expansion_region_1 = nullptr;
-	scratchpad = nullptr;
-	io_ports = nullptr;
-	bios_rom = nullptr;
+#if defined(BUS_FASTMEM)
+	//shared memory so the fastmem views alias the same pages
+	s32 fd = create_shared_memory("psemu-memory", ARENA_SIZE);
+	if (fd >= 0) {
+		void* memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory != MAP_FAILED) {
+			arena = (u8*)memory;
+			arena_shared = true;
+			allocate_fastmem(fd);
+		}
+		//the mappings keep the memory alive
+		close(fd);
+	}
+#endif
+
+#if defined(_WIN32)
+	//large pages need a privilege most users do not have, regular pages it is
+	arena = (u8*)VirtualAlloc(nullptr, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	if (arena == nullptr) {
+		void* memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		arena = memory != MAP_FAILED ? (u8*)memory : nullptr;
+	}
+#endif
+
+	if (arena == nullptr) {
+		printf("!!Failed to allocate %u bytes of guest memory!!\n", ARENA_SIZE);
+		assert(false);
+		return;
+	}
+
+#if defined(MADV_HUGEPAGE)
+	//2MB pages cover main ram with a single tlb entry, best effort
+	madvise(arena, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
 }
 
-void Bus::load_bios(const std::string& path)
+void Bus::zero_memory(u32 offset, u32 size)
 {
-	std::ifstream file(path, std::ios::binary | std::ios::ate);
-	if (file.is_open()) {
-		u32 size = file.tellg();
-		file.seekg(0, file.beg);
+	//dropped pages read back as zero and are only committed again once touched
+#if defined(_WIN32)
+	VirtualFree(arena + offset, size, MEM_DECOMMIT);
+	VirtualAlloc(arena + offset, size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+	madvise(arena + offset, size, arena_shared ? MADV_REMOVE : MADV_DONTNEED);
+#else
+	memset(arena + offset, 0x0, size);
+#endif
+}
 
-		if (size > BIOS_SIZE) {
-			std::cerr << "Bios file: " + path + " is too large\n";
-			return;
-		}
+#if defined(BUS_FASTMEM)
+static const u32 fastmem_segments[] = { 0x00000000, 0x80000000, 0xA0000000 }; //kuseg, kseg0, kseg1
 
-		if (size == BIOS_SIZE) {
-			printf("Original bios loaded\n");
-			bios_rom = new u8[size];
+bool Bus::allocate_fastmem(s32 fd)
+{
+	//nothing is accessible until a view is mapped over it, io ports, bios and
+	//unmapped addresses fault so recompiled code can take the slow path
+	//and pay the wait states of the region
+	void* memory = mmap(nullptr, FASTMEM_ARENA_SIZE, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (memory == MAP_FAILED) {
+		printf("!!Failed to reserve the fastmem arena!!\n");
+		return false;
+	}
+	fastmem_base = (u8*)memory;
 
-			file.read((char*)bios_rom, BIOS_SIZE);
-			file.close();
-		}
-		else {
-			std::cerr << "!!Bios size does not match original size!!\n";
-			return;
-		}
+	bool mapped = true;
+	for (u32 segment : fastmem_segments) {
+		for (u32 mirror = 0; mirror < 0x800000; mirror += MAIN_RAM_SIZE)
+			mapped &= map_view(fd, segment + mirror, ARENA_MAIN_RAM, MAIN_RAM_SIZE, true);
+		mapped &= map_view(fd, segment + 0x1F800000, ARENA_SCRATCHPAD, SCRATCHPAD_SIZE, true);
+	}
+
+	if (!mapped) {
+		printf("!!Failed to map guest memory into the fastmem arena!!\n");
+		munmap(fastmem_base, FASTMEM_ARENA_SIZE);
+		fastmem_base = nullptr;
+		return false;
+	}
+	return true;
+}
+
+s32 Bus::create_shared_memory(const char* name, u32 size)
+{
+	s32 fd = memfd_create(name, 0);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool Bus::map_view(s32 fd, u32 address, u32 offset, u32 size, bool writable)
+{
+	s32 protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	void* view = mmap(fastmem_base + address, size, protection, MAP_SHARED | MAP_FIXED, fd, offset);
+	return view != MAP_FAILED;
+}
+#endif
+
+void Bus::reset()
+{
+	//everything but the bios, which sits at the end of the arena
+	zero_memory(0, ARENA_BIOS);
+	unmap_region(0x1F000000, ER_1_SIZE);
+	reset_memory_control();
+
+	//ram was zeroed behind the code cache, drop what was decoded from it
+	if (code_cache != nullptr) {
+		for (u32 offset = 0; offset < MAIN_RAM_SIZE; offset += CODE_PAGE_SIZE)
+			check_code_page(offset);
 	}
 	else {
-		std::cerr << "!!Bios file: " + path + "failed to open!!\n";
-		return;
+		clear_code_pages();
 	}
+	interrupts.reset();
+}
+
+void Bus::reset_memory_control()
+{
+	//what the bios programs during boot
+	const u32 defaults[] = {
+		0x1F000000, //expansion 1 base
+		0x1F802000, //expansion 2 base
+		0x0013243F, //expansion 1 delay/size
+		0x00003022, //expansion 3 delay/size
+		0x0013243F, //bios delay/size
+		0x200931E1, //spu delay/size
+		0x00020843, //cdrom delay/size
+		0x00070777, //expansion 2 delay/size
+		0x00031125 //common delay
+	};
+	memcpy(io_ports, defaults, sizeof(defaults));
+	update_access_times();
 }
 
-void Bus::write_u8(u32 address, u8 byte)
+void Bus::update_access_times()
 {
-	//KSEG1 for now
-	if (address >= 0xA0000000 && address <= (0xA0000000 + MAIN_RAM_SIZE)) {
-		main_ram[address - 0xA0000000] = byte;
+	u32 common_delay;
+	memcpy(&common_delay, &io_ports[0x20], sizeof(common_delay));
+	u32 com0 = common_delay & 0xF;
+	u32 com2 = (common_delay >> 8) & 0xF;
+	u32 com3 = (common_delay >> 12) & 0xF;
+
+	//formula from the nocash psx specs
+	for (u32 region = 0; region < MEMORY_REGION_COUNT; region++) {
+		u32 delay_size;
+		memcpy(&delay_size, &io_ports[0x08 + region * 4], sizeof(delay_size));
+		u32 access_time = (delay_size >> 4) & 0xF;
+		bool use_com0 = (delay_size & (1 << 8)) != 0;
+		bool use_com2 = (delay_size & (1 << 10)) != 0;
+		bool use_com3 = (delay_size & (1 << 11)) != 0;
+		bool bus_16bit = (delay_size & (1 << 12)) != 0;
+
+		s32 first = 0, sequential = 0, minimum = 0;
+		if (use_com0) {
+			first += (s32)com0 - 1;
+			sequential += (s32)com0 - 1;
+		}
+		if (use_com2) {
+			first += com2;
+			sequential += com2;
+		}
+		if (use_com3)
+			minimum = com3;
+		if (first < 6)
+			first++;
+
+		first += access_time + 2;
+		sequential += access_time + 2;
+		first = std::max(first, minimum + 6);
+		sequential = std::max(sequential, minimum + 2);
+
+		//an 8 bit bus splits halfwords and words into sequential accesses
+		s32 byte = first;
+		s32 halfword = bus_16bit ? first : first + sequential;
+		s32 word = bus_16bit ? first + sequential : first + sequential * 3;
+
+		//one cycle of each access is already counted by the instruction
+		access_times[region][0] = (u8)std::max(byte - 1, 0);
+		access_times[region][1] = (u8)std::max(halfword - 1, 0);
+		access_times[region][2] = (u8)std::max(word - 1, 0);
 	}
-	//Open bus after main ram??? ignore
-	else if (address > (0xA0000000 + MAIN_RAM_SIZE) && address < 0xBF000000) {
-		printf("U8 Memory write attempt after main ram 2048K range (open bus)\n");
+}
+
+u32 Bus::region_access_time(u32 physical, u32 width)
+{
+	MemoryRegion region;
+	if (physical >= 0x1FC00000 && physical < (0x1FC00000 + BIOS_SIZE))
+		region = REGION_BIOS;
+	else if (physical < 0x1F800000)
+		region = REGION_EXPANSION_1;
+	else if (physical >= 0x1F801800 && physical < 0x1F801810)
+		region = REGION_CDROM;
+	else if (physical >= 0x1F801C00 && physical < 0x1F802000)
+		region = REGION_SPU;
+	else if (physical >= 0x1F802000 && physical < 0x1F804000)
+		region = REGION_EXPANSION_2;
+	else if (physical >= 0x1FA00000 && physical < 0x1FC00000)
+		region = REGION_EXPANSION_3;
+	else
+		return 0; //scratchpad and the other io ports
+
+	return access_times[region][width];
+}
+
+u32 Bus::memory_control_read(void* device, u32 address)
+{
+	Bus* bus = (Bus*)device;
+	u32 value;
+	memcpy(&value, &bus->io_ports[address - 0x1F801000], sizeof(value));
+	return value;
+}
+
+template <typename T>
+void Bus::memory_control_write(void* device, u32 address, u32 value)
+{
+	Bus* bus = (Bus*)device;
+	T narrowed = (T)value;
+	memcpy(&bus->io_ports[address - 0x1F801000], &narrowed, sizeof(narrowed));
+
+	//the base addresses do not change the timing
+	if (address < 0x1F801008)
 		return;
+
+	u8 bios_fetch = bus->access_times[REGION_BIOS][2];
+	bus->update_access_times();
+
+	//decoded bios instructions carry the fetch cost they were decoded with
+	if (bus->access_times[REGION_BIOS][2] != bios_fetch && bus->code_cache != nullptr) {
+		for (u32 offset = 0; offset < BIOS_SIZE; offset += CODE_PAGE_SIZE)
+			bus->code_cache->invalidate(0x1FC00000 + offset);
 	}
+}
+
+void Bus::map_memory()
+{
+	//main ram repeats through the first 8MB
+	for (u32 mirror = 0; mirror < 0x800000; mirror += MAIN_RAM_SIZE)
+		map_region(mirror, MAIN_RAM_SIZE, main_ram, true);
+	map_region(0x1F800000, SCRATCHPAD_SIZE, scratchpad, true);
+	map_region(0x1FC00000, BIOS_SIZE, bios_rom, false);
+}
 
-	//Expansion region 1
-	else if (address >= 0xBF000000 && address < (0xBF000000 + ER_1_SIZE)) {
-		expansion_region_1[address - 0xBF000000] = byte;
+void Bus::map_region(u32 physical_address, u32 size, u8* memory, bool writable)
+{
+	for (u32 offset = 0; offset < size; offset += MEMORY_PAGE_SIZE) {
+		u32 page = (physical_address + offset) >> MEMORY_PAGE_SHIFT;
+		read_pages[page] = memory + offset;
+		write_pages[page] = writable ? memory + offset : nullptr;
 	}
-	else if (address >= 0xBF800000 && address < (0xBF800000 + SCRATCHPAD_SIZE)) {
-		scratchpad[address - 0xBF800000] = byte;
+}
+
+void Bus::unmap_region(u32 physical_address, u32 size)
+{
+	for (u32 offset = 0; offset < size; offset += MEMORY_PAGE_SIZE) {
+		u32 page = (physical_address + offset) >> MEMORY_PAGE_SHIFT;
+		read_pages[page] = nullptr;
+		write_pages[page] = nullptr;
 	}
-	else if (address >= 0xBF801000 && address <= (0xBF801000 + IO_PORTS_SIZE)) {
-		io_ports[address - 0xBF801000] = byte;
+}
+
+u8* Bus::commit_expansion_page(u32 physical)
+{
+	//the untouched arena pages behind it are never faulted in before this
+	u32 offset = (physical - 0x1F000000) & ~(MEMORY_PAGE_SIZE - 1);
+	u8* memory = expansion_region_1 + offset;
+	memset(memory, 0xFF, MEMORY_PAGE_SIZE);
+	map_region(0x1F000000 + offset, MEMORY_PAGE_SIZE, memory, true);
+
+	return memory;
+}
+
+void Bus::load_bios(const std::string& path)
+{
+	//done before the cpu starts, nothing is decoded from the old contents yet
+	std::shared_ptr<BiosImage> image = BiosImage::open(path);
+	if (image == nullptr)
+		return;
+
+	//reads go straight to the shared pages, writes never reach them
+	bios_image = image;
+	bios_rom = (u8*)image->data;
+	map_region(0x1FC00000, BIOS_SIZE, bios_rom, false);
+}
+
+void Bus::attach_code_cache(CodeCache* code_cache)
+{
+	//pages marked for the previous cache mean nothing to this one
+	this->code_cache = code_cache;
+	clear_code_pages();
+}
+
+void Bus::attach_tracer(MemoryTracer* tracer)
+{
+	if (this->tracer != nullptr)
+		this->tracer->set_generation(nullptr);
+	this->tracer = tracer;
+	if (tracer != nullptr)
+		tracer->set_generation(&observer_generation);
+	observer_generation++;
+}
+
+void Bus::add_watchpoint(u32 address, u32 length, u8 flags)
+{
+	watchpoints.push_back({ address & 0x1FFFFFFF, length, flags });
+	observer_generation++;
+}
+
+void Bus::clear_watchpoints()
+{
+	watchpoints.clear();
+	observer_generation++;
+}
+
+void Bus::set_watchpoint_handler(WatchpointHandler handler, void* context)
+{
+	watchpoint_handler = handler;
+	watchpoint_context = context;
+}
+
+u8 Bus::policy()
+{
+	u8 policy = BUS_PLAIN;
+	if (!watchpoints.empty())
+		policy |= BUS_WATCHPOINTS;
+	if (tracer != nullptr)
+		policy |= BUS_TRACING;
+	return policy;
+}
+
+bool Bus::observed(u32 physical_address, u32 length)
+{
+	if (tracer != nullptr && tracer->overlaps(physical_address, length))
+		return true;
+	for (Watchpoint& watchpoint : watchpoints) {
+		if (watchpoint.start < ((u64)physical_address + length) &&
+			physical_address < ((u64)watchpoint.start + watchpoint.length))
+			return true;
 	}
-	else {
-		printf("U8 Memory write attempt at unhandled address: 0x%08X\n", address);
+	return false;
+}
+
+bool Bus::map_mmio(u32 address, u32 length, u8 widths,
+	MmioReadHandler read, MmioWriteHandler write, void* device)
+{
+	return mmio.register_handler(address, length, widths, read, write, device);
+}
+
+bool Bus::pollable(u32 address, u32 size)
+{
+	u32 physical = address & 0x1FFFFFFF;
+	if (physical >= 0x1F801000 && physical < (0x1F801000 + IO_PORTS_SIZE))
+		return mmio.pollable(physical, size);
+
+	//memory and open bus
+	return true;
+}
+
+void Bus::request_interrupt(InterruptSource source)
+{
+	interrupts.request(source);
+}
+
+void Bus::set_interrupt_handler(InterruptLineHandler handler, void* context)
+{
+	interrupts.set_line_handler(handler, context);
+}
+
+void Bus::mark_code_page(u32 physical_address)
+{
+	u32 page = (physical_address & (MAIN_RAM_SIZE - 1)) >> CODE_PAGE_SHIFT;
+	code_pages[page >> 5] |= (1 << (page & 31));
+}
+
+void Bus::clear_code_pages()
+{
+	code_pages.fill(0);
+}
+
+void Bus::check_code_page(u32 offset)
+{
+	u32 page = (offset & (MAIN_RAM_SIZE - 1)) >> CODE_PAGE_SHIFT;
+	u32 bit = 1 << (page & 31);
+	if ((code_pages[page >> 5] & bit) == 0)
+		return;
+
+	code_pages[page >> 5] &= ~bit;
+	code_cache->invalidate(offset);
+}
+
+template <typename T, u8 Policy>
+void Bus::write(u32 address, T value)
+{
+	//the cpu raises address errors before it gets here, the low bits are dropped
+	address &= ~(u32)(sizeof(T) - 1);
+	if ((Policy & BUS_TRACING) != 0)
+		tracer->record(address, value, sizeof(T), true);
+	if ((Policy & BUS_WATCHPOINTS) != 0)
+		check_watchpoints(address, value, sizeof(T), true);
+
+	u32 physical = address & 0x1FFFFFFF;
+	u8* page = write_pages[physical >> MEMORY_PAGE_SHIFT];
+	if (page == nullptr) {
+		write_mmio(address, value, sizeof(T));
 		return;
 	}
+
+	memcpy(&page[physical & (MEMORY_PAGE_SIZE - 1)], &value, sizeof(T));
+	if (physical < 0x800000)
+		check_code_page(physical);
 }
 
-void Bus::write_u16(u32 address, u16 halfword)
+
+void Bus::write_block(u32 address, const u8* data, u32 size)
 {
+	//copied a page at a time so each code page is checked once
+	u32 offset = address & (MAIN_RAM_SIZE - 1);
+	while (size > 0) {
+		u32 count = std::min(size, CODE_PAGE_SIZE - (offset & (CODE_PAGE_SIZE - 1)));
+		count = std::min(count, MAIN_RAM_SIZE - offset);
+		memcpy(&main_ram[offset], data, count);
+		check_code_page(offset);
+
+		data += count;
+		size -= count;
+		offset = (offset + count) & (MAIN_RAM_SIZE - 1);
+	}
 }
 
-void Bus::write_u32(u32 address, u32 word)
+template <typename T, u8 Policy>
+T Bus::read(u32 address)
 {
+	address &= ~(u32)(sizeof(T) - 1);
+	u32 physical = address & 0x1FFFFFFF;
+	u8* page = read_pages[physical >> MEMORY_PAGE_SHIFT];
+	T value;
+	if (page == nullptr)
+		value = (T)read_mmio(address, sizeof(T));
+	else
+		memcpy(&value, &page[physical & (MEMORY_PAGE_SIZE - 1)], sizeof(T));
+
+	if ((Policy & BUS_TRACING) != 0)
+		tracer->record(address, value, sizeof(T), false);
+	if ((Policy & BUS_WATCHPOINTS) != 0)
+		check_watchpoints(address, value, sizeof(T), false);
+	return value;
 }
 
-u8 Bus::read_u8(u32 address)
+#define INSTANTIATE_BUS_ACCESS(policy) \
+	template u8 Bus::read<u8, policy>(u32 address); \
+	template u16 Bus::read<u16, policy>(u32 address); \
+	template u32 Bus::read<u32, policy>(u32 address); \
+	template void Bus::write<u8, policy>(u32 address, u8 value); \
+	template void Bus::write<u16, policy>(u32 address, u16 value); \
+	template void Bus::write<u32, policy>(u32 address, u32 value);
+
+INSTANTIATE_BUS_ACCESS(BUS_PLAIN)
+INSTANTIATE_BUS_ACCESS(BUS_WATCHPOINTS)
+INSTANTIATE_BUS_ACCESS(BUS_TRACING)
+INSTANTIATE_BUS_ACCESS(BUS_WATCHPOINTS | BUS_TRACING)
+#undef INSTANTIATE_BUS_ACCESS
+
+void Bus::check_watchpoints(u32 address, u32 value, u8 width, bool write)
 {
-	if (address >= 0xA0000000 && address <= (0xA0000000 + MAIN_RAM_SIZE)) {
-		return main_ram[address - 0xA0000000];
+	u32 physical = address & 0x1FFFFFFF;
+	u8 flag = write ? WATCH_WRITE : WATCH_READ;
+	for (Watchpoint& watchpoint : watchpoints) {
+		if ((watchpoint.flags & flag) == 0)
+			continue;
+		//hit when any byte of the access is inside
+		if (physical < ((u64)watchpoint.start + watchpoint.length) && watchpoint.start < (physical + width)) {
+			if (watchpoint_handler != nullptr)
+				watchpoint_handler(watchpoint_context, address, value, width, write);
+			return;
+		}
 	}
-	//Open bus after main ram??? ignore
-	else if (address > (0xA0000000 + MAIN_RAM_SIZE) && address < 0xBF000000) {
-		printf("U8 Memory read attempt after main ram 2048K range (open bus)\n");
-		return 0xFF;
+}
+
+const u8* Bus::fetch_region(u32 address, u32& start, u32& size)
+{
+	//kuseg, kseg0 and kseg1 see the same physical memory
+	u32 physical = address & 0x1FFFFFFF;
+	u32 segment = address - physical;
+	if (segment != 0x00000000 && segment != 0x80000000 && segment != 0xA0000000)
+		return nullptr;
+
+	//main ram and its mirrors up to 8MB
+	if (physical < 0x800000 && main_ram != nullptr) {
+		start = segment | (physical & ~(MAIN_RAM_SIZE - 1));
+		size = MAIN_RAM_SIZE;
+		return main_ram;
+	}
+	if (physical >= 0x1FC00000 && physical < (0x1FC00000 + BIOS_SIZE) && bios_rom != nullptr) {
+		start = segment | 0x1FC00000;
+		size = BIOS_SIZE;
+		return bios_rom;
 	}
 
-	//Expansion region 1
-	else if (address >= 0xBF000000 && address < (0xBF000000 + ER_1_SIZE)) {
-		return expansion_region_1[address - 0xBF000000];
+	return nullptr;
+}
+
+u32 Bus::read_mmio(u32 address, u32 size)
+{
+	u32 physical = address & 0x1FFFFFFF;
+	if (physical >= 0x1F801000 && physical < (0x1F801000 + IO_PORTS_SIZE)) {
+		return mmio.read(physical, size);
 	}
-	else if (address >= 0xBF800000 && address < (0xBF800000 + SCRATCHPAD_SIZE)) {
-		return scratchpad[address - 0xBF800000];
+	//a page of expansion region 1 that was never written
+	else if (physical >= 0x1F000000 && physical < (0x1F000000 + ER_1_SIZE)) {
+		return 0xFFFFFFFF >> (32 - size * 8);
 	}
-	else if (address >= 0xBF801000 && address <= (0xBF801000 + IO_PORTS_SIZE)) {
-		return io_ports[address - 0xBF801000];
+	//Open bus after main ram??? ignore
+	else if (physical >= 0x800000 && physical < 0x1F000000) {
+		printf("U%u Memory read attempt after main ram 8192K range (open bus)\n", size * 8);
+		return 0xFFFFFFFF >> (32 - size * 8);
 	}
 	else {
-		printf("U8 Memory read attempt at unhandled address: 0x%08X\n", address);
+		printf("U%u Memory read attempt at unhandled address: 0x%08X\n", size * 8, address);
 		return 0x00;
 	}
 }
 
-u16 Bus::read_u16(u32 address)
+void Bus::write_mmio(u32 address, u32 value, u32 size)
 {
-	if ((address % 2) != 0) {
-		printf("!!Unaligned read u16 at address: 0x%08X\n", address);
-		return 0x0;
+	u32 physical = address & 0x1FFFFFFF;
+	if (physical >= 0x1F801000 && physical < (0x1F801000 + IO_PORTS_SIZE)) {
+		mmio.write(physical, value, size);
 	}
-}
-
-u32 Bus::read_u32(u32 address)
-{
-	if ((address % 2) != 0) {
-		printf("!!Unaligned read u32 at address: 0x%08X\n", address);
-		return 0x0;
+	else if (physical >= 0x1F000000 && physical < (0x1F000000 + ER_1_SIZE)) {
+		u8* page = commit_expansion_page(physical);
+		memcpy(&page[physical & (MEMORY_PAGE_SIZE - 1)], &value, size);
 	}
-}
+	//Open bus after main ram??? ignore
+	else if (physical >= 0x800000 && physical < 0x1F000000) {
+		printf("U%u Memory write attempt after main ram 8192K range (open bus)\n", size * 8);
+	}
+	else {
+		printf("U%u Memory write attempt at unhandled address: 0x%08X\n", size * 8, address);
+	}
+}
\ No newline at end of file
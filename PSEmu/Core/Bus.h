@@ -1,30 +1,200 @@
 #pragma once
 #include "Common.h"
-#include <fstream>
+#include "Mmio.h"
+#include "Interrupts.h"
+#include "MemoryTrace.h"
+#include <array>
+#include <vector>
+#include <memory>
 
 #define BIOS_SIZE 0x80000
 #define MAIN_RAM_SIZE 0x200000
 #define ER_1_SIZE 0x800000
 #define SCRATCHPAD_SIZE 0x1000
-#define IO_PORTS_SIZE 0x2000
+
+//every region lives in one arena, contiguous for snapshots. Offsets are page
+//aligned for the fastmem views, the bios goes last so reset zeroes one range.
+//The bios slot stays blank, loaded images are mapped from the file instead
+#define ARENA_MAIN_RAM 0x0
+#define ARENA_EXPANSION_REGION_1 (ARENA_MAIN_RAM + MAIN_RAM_SIZE)
+#define ARENA_SCRATCHPAD (ARENA_EXPANSION_REGION_1 + ER_1_SIZE)
+#define ARENA_IO_PORTS (ARENA_SCRATCHPAD + SCRATCHPAD_SIZE)
+#define ARENA_BIOS (ARENA_IO_PORTS + IO_PORTS_SIZE)
+#define ARENA_SIZE 0xC00000 //rounded up to 2MB huge pages
+
+//the page table covers the 512MB physical space, every segment
+//and mirror resolves to a physical page
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_COUNT (0x20000000 >> MEMORY_PAGE_SHIFT)
+
+//guest addresses map 1:1 into a reserved host range, linux only for now
+#if defined(__linux__) && defined(__x86_64__)
+#define BUS_FASTMEM
+#define FASTMEM_ARENA_SIZE 0x100000000ull
+#endif
+
+//granularity of code tracking in main ram
+#define CODE_PAGE_SHIFT 12
+#define CODE_PAGE_SIZE (1 << CODE_PAGE_SHIFT)
+#define CODE_PAGE_BITMAP_WORDS ((MAIN_RAM_SIZE >> CODE_PAGE_SHIFT) / 32)
+
+//regions with a delay/size register in memory control, in register order from 0x1F801008
+enum MemoryRegion : u8 {
+	REGION_EXPANSION_1,
+	REGION_EXPANSION_3,
+	REGION_BIOS,
+	REGION_SPU,
+	REGION_CDROM,
+	REGION_EXPANSION_2,
+	MEMORY_REGION_COUNT
+};
+
+//what an access checks besides the memory map. Every combination is its own
+//instantiation of the access paths, so the plain one carries no checks at all
+enum BusPolicy : u8 {
+	BUS_PLAIN = 0x0,
+	BUS_WATCHPOINTS = 0x1,
+	BUS_TRACING = 0x2
+};
+#define BUS_POLICY_COUNT 4
+
+#define WATCH_READ 0x1
+#define WATCH_WRITE 0x2
+
+//called on every access to a watched range, before a write lands
+typedef void (*WatchpointHandler)(void* context, u32 address, u32 value, u8 width, bool write);
+
+struct Watchpoint {
+	u32 start; //physical
+	u32 length;
+	u8 flags;
+};
+
+struct CodeCache;
+struct BiosImage;
 
 struct Bus {
+	friend struct Recompiler;
+
 	Bus();
 	~Bus();
 	void reset();
 	void load_bios(const std::string& path);
-	void write_u8(u32 address, u8 byte);
-	void write_u16(u32 address, u16 halfword);
-	void write_u32(u32 address, u32 word);
+	void attach_code_cache(CodeCache* code_cache);
+
+	//the cpu switches to the matching access policy before it runs next
+	void attach_tracer(MemoryTracer* tracer); //nullptr stops tracing
+	void add_watchpoint(u32 address, u32 length, u8 flags);
+	void clear_watchpoints();
+	void set_watchpoint_handler(WatchpointHandler handler, void* context);
+	u8 policy();
+	u32 policy_generation() { return observer_generation; } //changes with policy or what it observes
+	bool observed(u32 physical_address, u32 length); //by the tracer or a watchpoint
+
+	//devices claim their io port registers, see MmioTable
+	bool map_mmio(u32 address, u32 length, u8 widths,
+		MmioReadHandler read, MmioWriteHandler write, void* device);
+	//reading address again returns the same value until something writes it
+	bool pollable(u32 address, u32 size);
+
+	//devices raise interrupts here, the cpu is told when its line changes
+	void request_interrupt(InterruptSource source);
+	void set_interrupt_handler(InterruptLineHandler handler, void* context);
+
+	//one path for every width, accesses are naturally aligned. Devices and
+	//the debugger use the plain policy, the cpu the one picked by policy()
+	template <typename T, u8 Policy = BUS_PLAIN> T read(u32 address);
+	template <typename T, u8 Policy = BUS_PLAIN> void write(u32 address, T value);
 
-	u8 read_u8(u32 address);
-	u16 read_u16(u32 address);
-	u32 read_u32(u32 address);
+	u8 read_u8(u32 address) { return read<u8>(address); }
+	u16 read_u16(u32 address) { return read<u16>(address); }
+	u32 read_u32(u32 address) { return read<u32>(address); }
+	void write_u8(u32 address, u8 byte) { write<u8>(address, byte); }
+	void write_u16(u32 address, u16 halfword) { write<u16>(address, halfword); }
+	void write_u32(u32 address, u32 word) { write<u32>(address, word); }
+	void write_block(u32 address, const u8* data, u32 size); //dma and exe loading
+
+	//set by the code cache when it decodes an instruction on a main ram page
+	void mark_code_page(u32 physical_address);
+	void clear_code_pages();
+
+	//wait states the cpu pays for an access on top of the instruction,
+	//ram and scratchpad cost nothing extra
+	template <typename T> u32 access_time(u32 address)
+	{
+		u32 physical = address & 0x1FFFFFFF;
+		if (physical < 0x1F000000)
+			return 0;
+		return region_access_time(physical, sizeof(T) >> 1);
+	}
+
+	//host memory backing the main ram or bios mirror holding address,
+	//nullptr when instructions there have to go through the bus
+	const u8* fetch_region(u32 address, u32& start, u32& size);
 
 private:
+	//all of these point into the arena, except a loaded bios
 	u8* main_ram;
 	u8* expansion_region_1;
 	u8* scratchpad;
-	u8* io_ports;
-	u8* bios_rom;
+	u8* io_ports; //latch for registers no device claimed
+	u8* bios_rom; //read only once a bios is loaded
+
+	//shared with every other Bus that loaded the same file
+	std::shared_ptr<BiosImage> bios_image;
+
+	u8* arena = nullptr;
+	bool arena_shared = false; //backed by a memfd the fastmem views map too
+
+	void allocate_arena();
+	void zero_memory(u32 offset, u32 size);
+#if defined(BUS_FASTMEM)
+	bool allocate_fastmem(s32 fd);
+	s32 create_shared_memory(const char* name, u32 size);
+	bool map_view(s32 fd, u32 address, u32 offset, u32 size, bool writable);
+#endif
+	void map_memory();
+	void map_region(u32 physical_address, u32 size, u8* memory, bool writable);
+	void unmap_region(u32 physical_address, u32 size);
+
+	//expansion region 1 reads as open bus and is committed a page
+	//at a time on the first write, almost nothing ever touches it
+	u8* commit_expansion_page(u32 physical);
+	u32 read_mmio(u32 address, u32 size);
+	void write_mmio(u32 address, u32 value, u32 size);
+	void check_code_page(u32 offset);
+	void check_watchpoints(u32 address, u32 value, u8 width, bool write);
+
+	u32 region_access_time(u32 physical, u32 width);
+	void reset_memory_control();
+	void update_access_times();
+	static u32 memory_control_read(void* device, u32 address);
+	//narrow writes only replace their bytes of the register
+	template <typename T> static void memory_control_write(void* device, u32 address, u32 value);
+
+	//host memory per physical page, nullptr goes to the mmio handlers
+	std::vector<u8*> read_pages;
+	std::vector<u8*> write_pages; //nullptr for rom too
+
+	//4GB of host address space mirroring the guest one, main ram and scratchpad
+	//are mapped at every segment and mirror, nullptr without fastmem
+	u8* fastmem_base = nullptr;
+
+	MmioTable mmio;
+	InterruptController interrupts;
+
+	//cycles per 8, 16 and 32 bit access, recomputed when memory control is written
+	std::array<std::array<u8, 3>, MEMORY_REGION_COUNT> access_times;
+
+	CodeCache* code_cache = nullptr;
+	MemoryTracer* tracer = nullptr; //sees every access of the tracing policy
+
+	std::vector<Watchpoint> watchpoints;
+	WatchpointHandler watchpoint_handler = nullptr;
+	void* watchpoint_context = nullptr;
+	u32 observer_generation = 0;
+	//one bit per main ram page holding decoded code, a write
+	//to a marked page invalidates just that page
+	std::array<u32, CODE_PAGE_BITMAP_WORDS> code_pages;
 };
\ No newline at end of file
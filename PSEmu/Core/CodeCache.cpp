@@ -0,0 +1,110 @@
+#include "CodeCache.h"
+#include "Cpu.h"
+
+struct DecodedPage {
+	DecodedInstruction instructions[CODE_PAGE_INSTRUCTIONS];
+	std::unique_ptr<BasicBlock> blocks[CODE_PAGE_INSTRUCTIONS];
+	u32 generation = 0; //bumped on invalidation, stale blocks are rebuilt on lookup
+};
+
+CodeCache::CodeCache(Bus* bus)
+	:bus(bus)
+{
+	reset();
+}
+
+CodeCache::~CodeCache()
+{
+
+}
+
+void CodeCache::reset()
+{
+	for (auto& page : pages)
+		page.reset();
+	bus->clear_code_pages();
+}
+
+DecodedInstruction* CodeCache::lookup(u32 address)
+{
+	s32 index = page_index(address);
+	if (index < 0)
+		return nullptr;
+
+	std::unique_ptr<DecodedPage>& page = pages[index];
+	if (page == nullptr)
+		page.reset(new DecodedPage());
+
+	return &page->instructions[(address & (CODE_PAGE_SIZE - 1)) >> 2];
+}
+
+void CodeCache::mark_decoded(u32 address)
+{
+	//bios rom is never written, only main ram needs tracking
+	if (page_index(address) < CODE_CACHE_RAM_PAGES)
+		bus->mark_code_page(address & 0x1FFFFFFF);
+}
+
+void CodeCache::invalidate(u32 address)
+{
+	s32 index = page_index(address);
+	if (index < 0 || pages[index] == nullptr)
+		return;
+
+	//entries are cleared and blocks aged rather than freed, a block
+	//on this page may still be running when its own page gets written
+	DecodedPage* page = pages[index].get();
+	for (DecodedInstruction& instruction : page->instructions)
+		instruction.execute = nullptr;
+	page->generation++;
+
+	if (invalidation_callback != nullptr)
+		invalidation_callback(invalidation_context, index);
+}
+
+BasicBlock* CodeCache::lookup_block(u32 address)
+{
+	s32 index = page_index(address);
+	if (index < 0 || pages[index] == nullptr)
+		return nullptr;
+
+	DecodedPage* page = pages[index].get();
+	BasicBlock* block = page->blocks[(address & (CODE_PAGE_SIZE - 1)) >> 2].get();
+	if (block == nullptr || block->generation != page->generation)
+		return nullptr;
+
+	//kseg0 and kseg1 share a slot but not their jump targets
+	if (block->address != address)
+		return nullptr;
+
+	return block;
+}
+
+BasicBlock* CodeCache::store_block(BasicBlock* block)
+{
+	DecodedPage* page = pages[page_index(block->address)].get();
+	block->generation = page->generation;
+	page->blocks[(block->address & (CODE_PAGE_SIZE - 1)) >> 2].reset(block);
+
+	return block;
+}
+
+void CodeCache::set_invalidation_callback(void (*callback)(void* context, s32 page), void* context)
+{
+	invalidation_callback = callback;
+	invalidation_context = context;
+}
+
+s32 CodeCache::page_index(u32 address)
+{
+	u32 physical = address & 0x1FFFFFFF;
+
+	//main ram and its mirrors up to 8MB
+	if (physical < 0x800000)
+		return (physical & (MAIN_RAM_SIZE - 1)) >> CODE_PAGE_SHIFT;
+
+	if (physical >= 0x1FC00000 && physical < (0x1FC00000 + BIOS_SIZE))
+		return CODE_CACHE_RAM_PAGES + ((physical - 0x1FC00000) >> CODE_PAGE_SHIFT);
+
+	return -1;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include "Common.h"
+#include "Bus.h"
+#include <array>
+#include <memory>
+
+#define CODE_PAGE_INSTRUCTIONS (CODE_PAGE_SIZE / 4)
+#define CODE_CACHE_RAM_PAGES (MAIN_RAM_SIZE / CODE_PAGE_SIZE)
+#define CODE_CACHE_BIOS_PAGES (BIOS_SIZE / CODE_PAGE_SIZE)
+#define CODE_CACHE_PAGES (CODE_CACHE_RAM_PAGES + CODE_CACHE_BIOS_PAGES)
+
+struct DecodedInstruction;
+struct DecodedPage;
+struct BasicBlock;
+
+//Pre-decoded instructions for main ram and bios rom, kept per 4KB page
+//and keyed by physical address so every mirror shares the same entries.
+//Entries are decoded lazily, an entry with no handler has not been decoded yet.
+//Basic blocks are stored by start address on the same pages
+struct CodeCache {
+	CodeCache(Bus* bus);
+	~CodeCache();
+
+	void reset();
+	DecodedInstruction* lookup(u32 address);
+	void mark_decoded(u32 address);
+	void invalidate(u32 address);
+
+	BasicBlock* lookup_block(u32 address);
+	BasicBlock* store_block(BasicBlock* block);
+
+	//called with the page index whenever a page holding decoded code is invalidated
+	void set_invalidation_callback(void (*callback)(void* context, s32 page), void* context);
+
+	static s32 page_index(u32 address);
+
+private:
+	std::array<std::unique_ptr<DecodedPage>, CODE_CACHE_PAGES> pages;
+	Bus* bus; //tracks writes to pages holding decoded code
+
+	void (*invalidation_callback)(void* context, s32 page) = nullptr;
+	void* invalidation_context = nullptr;
+};
\ No newline at end of file
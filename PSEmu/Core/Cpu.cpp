@@ -1,75 +1,640 @@
 #include "Cpu.h"
 #include "Bus.h"
 
-Cpu::Cpu()
+Cpu::Cpu(Bus* bus)
+	:code_cache(bus), bus(bus), recompiler(this)
 {
 	reset();
-	map_opcodes();
+	bus->attach_code_cache(&code_cache);
+	bus->set_interrupt_handler(&Cpu::interrupt_line_changed, this);
 }
 
 Cpu::~Cpu()
 {
-
+	bus->attach_code_cache(nullptr);
+	bus->set_interrupt_handler(nullptr, nullptr);
 }
 
 void Cpu::reset()
 {
-	memset(gprs, 0x0, 0x20);
-	memset(lds.output_gprs, 0x0, 0x20);
+	memset(gprs, 0x0, sizeof(gprs));
+	load_delay_register = next_load_delay_register = 0;
+	load_delay_value = next_load_delay_value = 0;
 
 	pc = 0xBFC00000; //point to bios rom
+	next_pc = pc + 4;
+	current_pc = pc;
+	delay_slot_address = 0;
+	cop0_bad_vaddr = cop0_epc = 0;
+	cop0_cause &= CAUSE_IP2; //still driven by the interrupt controller
+	cop0_sr = SR_BEV; //exception vectors start out in the bios
+	update_interrupt_pending();
 	hi = lo = 0x0;
+	stall_cycles = 0;
+	cycle_count = 0;
+	run_elapsed = 0;
+	cycle_offset = 0;
+	executing_block = nullptr;
+	muldiv_ready = 0;
+	fetch_host = nullptr;
+	fetch_start = fetch_size = 0;
+	recompiler.flush(); //drops the code cache along with any host code
 }
 
-u8 Cpu::clock()
+void Cpu::set_pc(u32 address)
 {
-	u32 opcode = fetch_u32();
-	next_instruction = read_u32();
+	pc = address;
+	next_pc = address + 4;
+}
 
-	decode_and_execute(opcode);
+void Cpu::attach_tracer(MemoryTracer* tracer)
+{
+	if (tracer != nullptr)
+		tracer->set_source(&current_pc, &Cpu::trace_cycle, this);
+	bus->attach_tracer(tracer);
+}
 
-	return cycles;
+void Cpu::set_execution_mode(ExecutionMode mode)
+{
+#if !defined(CPU_THREADED_DISPATCH)
+	if (mode == ExecutionMode::ThreadedInterpreter) {
+		printf("Threaded dispatch is not supported by this compiler, using the interpreter\n");
+		mode = ExecutionMode::Interpreter;
+	}
+#endif
+	this->mode = mode;
 }
 
-void Cpu::decode_and_execute(u32 opcode)
+void Cpu::set_bus_policy(u8 policy)
 {
-	u8 primary_opcode = (opcode >> 26) & 0x3F;
+	//decoded instructions and host code hold the handlers of the old policy
+	bus_policy = policy;
+	policy_generation = bus->policy_generation();
+	recompiler.flush();
+}
 
-	InstructionBitField ibf;
-	ibf.opcode = opcode;
+u32 Cpu::run(u32 cycle_budget)
+{
+	if (policy_generation != bus->policy_generation())
+		set_bus_policy(bus->policy());
+
+	u32 elapsed = 0;
+	switch (mode) {
+		case ExecutionMode::Interpreter:
+			while (elapsed < cycle_budget) {
+				if (interrupt_pending)
+					take_interrupt();
+				run_elapsed = elapsed;
+				elapsed += clock();
+			}
+		break;
+#if defined(CPU_THREADED_DISPATCH)
+		case ExecutionMode::ThreadedInterpreter:
+			switch (bus_policy) {
+				case BUS_PLAIN: elapsed = run_threaded<BUS_PLAIN>(cycle_budget); break;
+				case BUS_WATCHPOINTS: elapsed = run_threaded<BUS_WATCHPOINTS>(cycle_budget); break;
+				case BUS_TRACING: elapsed = run_threaded<BUS_TRACING>(cycle_budget); break;
+				default: elapsed = run_threaded<BUS_WATCHPOINTS | BUS_TRACING>(cycle_budget); break;
+			}
+		break;
+#endif
+		case ExecutionMode::CachedInterpreter:
+			while (elapsed < cycle_budget) {
+				run_elapsed = elapsed;
+				elapsed += execute_block(cycle_budget - elapsed);
+			}
+		break;
+		case ExecutionMode::Recompiler:
+			while (elapsed < cycle_budget) {
+				run_elapsed = elapsed;
+				elapsed += recompiler.execute(cycle_budget - elapsed);
+			}
+		break;
+	}
 
-	if(load_delay)
-		lds.save_output(); 
+	cycle_count += elapsed;
+	run_elapsed = 0;
+	return elapsed;
+}
 
-	cycles = primary_lut[primary_opcode].cycles;
-	primary_lut[primary_opcode].execute(ibf);
+#if defined(CPU_THREADED_DISPATCH)
+template <u8 Policy>
+u32 Cpu::run_threaded(u32 cycle_budget)
+{
+	//same layout as primary_lut and secondary_lut, special
+	//continues through the secondary labels
+	static void* const primary_labels[0x40] = {
+		/*0x00*/ &&op_special,
+		/*0x01*/ &&op_bcond,
+		/*0x02*/ &&op_j,
+		/*0x03*/ &&op_jal,
+		/*0x04*/ &&op_beq,
+		/*0x05*/ &&op_bne,
+		/*0x06*/ &&op_blez,
+		/*0x07*/ &&op_bgtz,
+		/*0x08*/ &&op_addi,
+		/*0x09*/ &&op_addiu,
+		/*0x0A*/ &&op_slti,
+		/*0x0B*/ &&op_sltiu,
+		/*0x0C*/ &&op_andi,
+		/*0x0D*/ &&op_ori,
+		/*0x0E*/ &&op_xori,
+		/*0x0F*/ &&op_lui,
+		/*0x10*/ &&op_cop0,
+		/*0x11*/ &&op_undefined,
+		/*0x12*/ &&op_undefined,
+		/*0x13*/ &&op_undefined,
+		/*0x14*/ &&op_undefined,
+		/*0x15*/ &&op_undefined,
+		/*0x16*/ &&op_undefined,
+		/*0x17*/ &&op_undefined,
+		/*0x18*/ &&op_undefined,
+		/*0x19*/ &&op_undefined,
+		/*0x1A*/ &&op_undefined,
+		/*0x1B*/ &&op_undefined,
+		/*0x1C*/ &&op_undefined,
+		/*0x1D*/ &&op_undefined,
+		/*0x1E*/ &&op_undefined,
+		/*0x1F*/ &&op_undefined,
+		/*0x20*/ &&op_lb,
+		/*0x21*/ &&op_lh,
+		/*0x22*/ &&op_lwl,
+		/*0x23*/ &&op_lw,
+		/*0x24*/ &&op_lbu,
+		/*0x25*/ &&op_lhu,
+		/*0x26*/ &&op_lwr,
+		/*0x27*/ &&op_undefined,
+		/*0x28*/ &&op_sb,
+		/*0x29*/ &&op_sh,
+		/*0x2A*/ &&op_swl,
+		/*0x2B*/ &&op_sw,
+		/*0x2C*/ &&op_undefined,
+		/*0x2D*/ &&op_undefined,
+		/*0x2E*/ &&op_swr,
+		/*0x2F*/ &&op_undefined,
+		/*0x30*/ &&op_undefined,
+		/*0x31*/ &&op_undefined,
+		/*0x32*/ &&op_undefined,
+		/*0x33*/ &&op_undefined,
+		/*0x34*/ &&op_undefined,
+		/*0x35*/ &&op_undefined,
+		/*0x36*/ &&op_undefined,
+		/*0x37*/ &&op_undefined,
+		/*0x38*/ &&op_undefined,
+		/*0x39*/ &&op_undefined,
+		/*0x3A*/ &&op_undefined,
+		/*0x3B*/ &&op_undefined,
+		/*0x3C*/ &&op_undefined,
+		/*0x3D*/ &&op_undefined,
+		/*0x3E*/ &&op_undefined,
+		/*0x3F*/ &&op_undefined
+	};
+	static void* const secondary_labels[0x40] = {
+		/*0x00*/ &&op_sll,
+		/*0x01*/ &&op_undefined,
+		/*0x02*/ &&op_undefined,
+		/*0x03*/ &&op_undefined,
+		/*0x04*/ &&op_undefined,
+		/*0x05*/ &&op_undefined,
+		/*0x06*/ &&op_undefined,
+		/*0x07*/ &&op_undefined,
+		/*0x08*/ &&op_jr,
+		/*0x09*/ &&op_jalr,
+		/*0x0A*/ &&op_undefined,
+		/*0x0B*/ &&op_undefined,
+		/*0x0C*/ &&op_syscall,
+		/*0x0D*/ &&op_breakpoint,
+		/*0x0E*/ &&op_undefined,
+		/*0x0F*/ &&op_undefined,
+		/*0x10*/ &&op_mfhi,
+		/*0x11*/ &&op_mthi,
+		/*0x12*/ &&op_mflo,
+		/*0x13*/ &&op_mtlo,
+		/*0x14*/ &&op_undefined,
+		/*0x15*/ &&op_undefined,
+		/*0x16*/ &&op_undefined,
+		/*0x17*/ &&op_undefined,
+		/*0x18*/ &&op_mult,
+		/*0x19*/ &&op_multu,
+		/*0x1A*/ &&op_div,
+		/*0x1B*/ &&op_divu,
+		/*0x1C*/ &&op_undefined,
+		/*0x1D*/ &&op_undefined,
+		/*0x1E*/ &&op_undefined,
+		/*0x1F*/ &&op_undefined,
+		/*0x20*/ &&op_add,
+		/*0x21*/ &&op_undefined,
+		/*0x22*/ &&op_sub,
+		/*0x23*/ &&op_undefined,
+		/*0x24*/ &&op_undefined,
+		/*0x25*/ &&op_undefined,
+		/*0x26*/ &&op_undefined,
+		/*0x27*/ &&op_undefined,
+		/*0x28*/ &&op_undefined,
+		/*0x29*/ &&op_undefined,
+		/*0x2A*/ &&op_undefined,
+		/*0x2B*/ &&op_undefined,
+		/*0x2C*/ &&op_undefined,
+		/*0x2D*/ &&op_undefined,
+		/*0x2E*/ &&op_undefined,
+		/*0x2F*/ &&op_undefined,
+		/*0x30*/ &&op_undefined,
+		/*0x31*/ &&op_undefined,
+		/*0x32*/ &&op_undefined,
+		/*0x33*/ &&op_undefined,
+		/*0x34*/ &&op_undefined,
+		/*0x35*/ &&op_undefined,
+		/*0x36*/ &&op_undefined,
+		/*0x37*/ &&op_undefined,
+		/*0x38*/ &&op_undefined,
+		/*0x39*/ &&op_undefined,
+		/*0x3A*/ &&op_undefined,
+		/*0x3B*/ &&op_undefined,
+		/*0x3C*/ &&op_undefined,
+		/*0x3D*/ &&op_undefined,
+		/*0x3E*/ &&op_undefined,
+		/*0x3F*/ &&op_undefined
+	};
+
+	u32 elapsed = 0;
+	DecodedInstruction uncached;
+	DecodedInstruction* instruction;
+
+	//every handler ends by fetching the next instruction and
+	//jumping straight to its label, there is no central loop
+#define DISPATCH() \
+	do { \
+		elapsed += stall_cycles; \
+		stall_cycles = 0; \
+		if (elapsed >= cycle_budget) \
+			return elapsed; \
+		if ((Policy & BUS_TRACING) != 0) \
+			run_elapsed = elapsed; \
+		instruction = &fetch_decoded(uncached); \
+		elapsed += instruction->cycles; \
+		goto *primary_labels[instruction->ibf.opcode >> 26]; \
+	} while (0)
+#define NEXT() \
+	do { \
+		if ((load_delay_register | next_load_delay_register) != 0) \
+			update_load_delay(); \
+		DISPATCH(); \
+	} while (0)
+#define HANDLER(name) op_##name: name(instruction->ibf); NEXT()
+#define MEMORY_HANDLER(name) op_##name: name<Policy>(instruction->ibf); NEXT()
+	//may start a fused pair, the decoded handler runs both
+#define FUSED_HANDLER(name) op_##name: (this->*instruction->execute)(instruction->ibf); NEXT()
+	//elapsed already counts the instruction, current_cycle wants its issue
+#define MULDIV_HANDLER(name) op_##name: run_elapsed = elapsed - instruction->cycles; name(instruction->ibf); NEXT()
+	//interrupts are taken after branches only, before the delay slot
+#define BRANCH_HANDLER(name) op_##name: name(instruction->ibf); \
+	if (interrupt_pending) { \
+		if ((load_delay_register | next_load_delay_register) != 0) \
+			update_load_delay(); \
+		take_interrupt(); \
+		DISPATCH(); \
+	} \
+	NEXT()
+
+	DISPATCH();
+
+op_special:
+	goto *secondary_labels[instruction->ibf.opcode & 0x3F];
+op_undefined:
+	undefined_instruction(instruction->ibf);
+	NEXT();
+
+	BRANCH_HANDLER(bcond);
+	BRANCH_HANDLER(j);
+	BRANCH_HANDLER(jal);
+	BRANCH_HANDLER(beq);
+	BRANCH_HANDLER(bne);
+	BRANCH_HANDLER(blez);
+	BRANCH_HANDLER(bgtz);
+	HANDLER(cop0);
+	HANDLER(addi);
+	HANDLER(addiu);
+	HANDLER(slti);
+	HANDLER(sltiu);
+	HANDLER(andi);
+	HANDLER(ori);
+	HANDLER(xori);
+	FUSED_HANDLER(lui);
+	MEMORY_HANDLER(lb);
+	MEMORY_HANDLER(lh);
+	MEMORY_HANDLER(lwl);
+	MEMORY_HANDLER(lw);
+	MEMORY_HANDLER(lbu);
+	MEMORY_HANDLER(lhu);
+	MEMORY_HANDLER(lwr);
+	MEMORY_HANDLER(sb);
+	MEMORY_HANDLER(sh);
+	MEMORY_HANDLER(swl);
+	MEMORY_HANDLER(sw);
+	MEMORY_HANDLER(swr);
+	HANDLER(sll);
+	BRANCH_HANDLER(jr);
+	BRANCH_HANDLER(jalr);
+	HANDLER(syscall);
+	HANDLER(breakpoint);
+	HANDLER(add);
+	HANDLER(sub);
+	MULDIV_HANDLER(mfhi);
+	MULDIV_HANDLER(mthi);
+	MULDIV_HANDLER(mflo);
+	MULDIV_HANDLER(mtlo);
+	MULDIV_HANDLER(mult);
+	MULDIV_HANDLER(multu);
+	MULDIV_HANDLER(div);
+	MULDIV_HANDLER(divu);
+
+#undef MULDIV_HANDLER
+#undef BRANCH_HANDLER
+#undef FUSED_HANDLER
+#undef MEMORY_HANDLER
+#undef HANDLER
+#undef NEXT
+#undef DISPATCH
+}
+#endif
+
+u32 Cpu::clock()
+{
+	DecodedInstruction uncached;
+	execute(fetch_decoded(uncached));
 
-	if (load_delay) {
-		write_register(lds.register_index, lds.register_value);
-		load_delay = false;
+	u32 elapsed = cycles + stall_cycles;
+	stall_cycles = 0;
+	return elapsed;
+}
+
+u32 Cpu::execute_block(u32 cycle_budget)
+{
+	if (interrupt_pending)
+		take_interrupt();
+
+	//the fetch raises the address error
+	if ((pc & 0x3) != 0)
+		return clock();
+
+	BasicBlock* block = code_cache.lookup_block(pc);
+	if (block == nullptr) {
+		//blocks only exist for main ram and bios rom
+		if (code_cache.lookup(pc) == nullptr)
+			return clock();
+		block = compile_block(pc);
 	}
+
+	executing_block = block;
+	u32 address = block->address;
+	u32 elapsed = block->cycles;
+	for (size_t i = 0; i < block->instructions.size(); i++) {
+		//a block entered at the delay slot of a branch on the previous
+		//page leaves after the slot, an exception leaves right away.
+		//Either way only what ran is charged
+		if (pc != address) {
+			elapsed = 0;
+			for (size_t j = 0; j < i; j++)
+				elapsed += block->instructions[j].cycles;
+			break;
+		}
+
+		current_pc = pc;
+		pc = next_pc;
+		next_pc += 4;
+		execute(block->instructions[i]);
+		address += 4;
+	}
+	executing_block = nullptr;
+
+	elapsed += stall_cycles;
+	stall_cycles = 0;
+
+	if (block->idle_loop && elapsed < cycle_budget)
+		elapsed += skip_idle_loop(block, elapsed, cycle_budget - elapsed);
+
+	return elapsed;
 }
 
-u32 Cpu::read_u32()
+BasicBlock* Cpu::compile_block(u32 address)
 {
-	u32 word = (bus->read_u8(pc + 1)) |
-		(bus->read_u8(pc + 2) << 8) |
-		(bus->read_u8(pc + 3) << 16) |
-		(bus->read_u8(pc + 4) << 24);
+	BasicBlock* block = new BasicBlock();
+	block->address = address;
+	block->cycles = 0;
+
+	u32 page_end = (address & ~(CODE_PAGE_SIZE - 1)) + CODE_PAGE_SIZE;
+	for (u32 current = address; current < page_end; current += 4) {
+		//blocks run every instruction on their own
+		DecodedInstruction* instruction = lookup_decoded(current);
+		block->instructions.push_back(unfuse(*instruction));
+		block->cycles += instruction->cycles;
+
+		if (is_branch(instruction->ibf.opcode)) {
+			//a delay slot on the next page starts the following block instead
+			if ((current + 4) < page_end) {
+				DecodedInstruction* delay_slot = lookup_decoded(current + 4);
+				block->instructions.push_back(unfuse(*delay_slot));
+				block->cycles += delay_slot->cycles;
+			}
+			break;
+		}
+	}
 
-	return word;
+	detect_idle_loop(block);
+	return code_cache.store_block(block);
 }
 
-u32 Cpu::fetch_u32()
+void Cpu::detect_idle_loop(BasicBlock* block)
 {
-	u32 word = (bus->read_u8(pc++)) |
-		(bus->read_u8(pc++) << 8) |
-		(bus->read_u8(pc++) << 16) |
-		(bus->read_u8(pc++) << 24);
+	//a short loop ending with a branch back to the start and its delay slot
+	size_t count = block->instructions.size();
+	if (count < 2 || count > IDLE_LOOP_MAX_INSTRUCTIONS)
+		return;
+
+	InstructionBitField& branch = block->instructions[count - 2].ibf;
+	u32 branch_address = block->address + (u32)(count - 2) * 4;
+	u8 branch_opcode = (branch.opcode >> 26) & 0x3F;
+	u32 target;
+	if (branch_opcode == 0x02)
+		target = ((branch_address + 4) & 0xF0000000) | (branch.immediate_26() << 2);
+	else if ((branch_opcode >= 0x04 && branch_opcode <= 0x07) || (branch_opcode == 0x01 && (branch.rt() & 0x1E) == 0))
+		target = branch_address + 4 + (branch.immediate_se() << 2);
+	else
+		return; //jr, jalr and the linking branches
+
+	if (target != block->address)
+		return;
+
+	//registers read and written by each instruction, anything else has side effects
+	u32 reads[IDLE_LOOP_MAX_INSTRUCTIONS];
+	u32 writes[IDLE_LOOP_MAX_INSTRUCTIONS];
+	u32 loop_writes = 0;
+	s32 load = -1;
+	for (size_t i = 0; i < count; i++) {
+		InstructionBitField& ibf = block->instructions[i].ibf;
+		u8 primary_opcode = (ibf.opcode >> 26) & 0x3F;
+		if (i == count - 2) {
+			if (branch_opcode == 0x02)
+				reads[i] = 0;
+			else if (branch_opcode == 0x04 || branch_opcode == 0x05)
+				reads[i] = (1u << ibf.rs()) | (1u << ibf.rt());
+			else
+				reads[i] = 1u << ibf.rs();
+			writes[i] = 0;
+		}
+		else if (block->instructions[i].execute == &Cpu::nop) {
+			reads[i] = 0;
+			writes[i] = 0;
+		}
+		else if (primary_opcode >= 0x09 && primary_opcode <= 0x0F) {
+			//addiu to lui, addi could trap
+			reads[i] = primary_opcode == 0x0F ? 0 : 1u << ibf.rs();
+			writes[i] = 1u << ibf.rt();
+		}
+		else if (is_load(ibf.opcode) && primary_opcode != 0x10 && primary_opcode != 0x22 && primary_opcode != 0x26 && load < 0) {
+			//one plain load, lwl and lwr merge with their target
+			reads[i] = 1u << ibf.rs();
+			writes[i] = 1u << ibf.rt();
+			load = (s32)i;
+		}
+		else {
+			return;
+		}
+		writes[i] &= ~1u;
+		reads[i] &= ~1u;
+		loop_writes |= writes[i];
+	}
+
+	//every register read has to be written earlier in the same iteration or
+	//not at all, so one pass from the start computes what the next would.
+	//A load lands one instruction late
+	u32 written = 0, landing = 0;
+	for (size_t i = 0; i < count; i++) {
+		if ((reads[i] & loop_writes & ~written) != 0)
+			return;
+		if ((writes[i] & landing) != 0)
+			return; //cancels the load in flight
+		written |= landing;
+		landing = 0;
+		if ((s32)i == load)
+			landing = writes[i];
+		else
+			written |= writes[i];
+	}
+	if (landing != 0)
+		return; //a load in the delay slot lands in the next iteration
+
+	block->idle_loop = true;
+	block->idle_load = load;
+}
+
+u32 Cpu::skip_idle_loop(const BasicBlock* block, u32 iteration_cycles, u32 cycle_budget)
+{
+	//only once a whole iteration ran and branched back
+	if (iteration_cycles == 0 || pc != block->address || next_pc != pc + 4 || load_delay_register != 0)
+		return 0;
+
+	//an interrupt would be taken first, tracing and watchpoints want to see every access
+	if (interrupt_pending || bus_policy != BUS_PLAIN)
+		return 0;
+
+	if (block->idle_load >= 0) {
+		InstructionBitField ibf = block->instructions[block->idle_load].ibf;
+		u8 primary_opcode = (ibf.opcode >> 26) & 0x3F;
+		u32 size = primary_opcode == 0x23 ? 4 : (primary_opcode & 1) ? 2 : 1;
+		if (!bus->pollable(read_register(ibf.rs()) + ibf.immediate_se(), size))
+			return 0;
+	}
+
+	//devices only change what the loop reads between runs, so every iteration
+	//until the budget is spent would be this one again. Whole iterations are
+	//skipped to keep the same cycle count as running them
+	u32 iterations = (cycle_budget + iteration_cycles - 1) / iteration_cycles;
+	return iterations * iteration_cycles;
+}
+
+void Cpu::decode_and_execute(u32 opcode)
+{
+	DecodedInstruction instruction = decode(opcode);
+	execute(instruction);
+}
+
+void Cpu::execute(DecodedInstruction& instruction)
+{
+	cycles = instruction.cycles;
+	(this->*instruction.execute)(instruction.ibf);
+
+	//nothing to retire unless a load is in flight
+	if ((load_delay_register | next_load_delay_register) != 0)
+		update_load_delay();
+}
+
+u32 Cpu::fetch_instruction(u32 address)
+{
+	//the region is resolved again only once pc leaves it
+	if ((address - fetch_start) >= fetch_size) {
+		fetch_host = bus->fetch_region(address, fetch_start, fetch_size);
+		if (fetch_host == nullptr) {
+			fetch_size = 0;
+			return (bus->read_u8(address)) |
+				(bus->read_u8(address + 1) << 8) |
+				(bus->read_u8(address + 2) << 16) |
+				(bus->read_u8(address + 3) << 24);
+		}
+	}
+
+	u32 word;
+	memcpy(&word, fetch_host + (address - fetch_start), sizeof(word));
 
 	return word;
 }
 
+DecodedInstruction* Cpu::lookup_decoded(u32 address)
+{
+	DecodedInstruction* instruction = code_cache.lookup(address);
+	if (instruction != nullptr && instruction->execute == nullptr) {
+		*instruction = decode_at(address);
+		fuse(*instruction, address);
+		code_cache.mark_decoded(address);
+	}
+
+	return instruction;
+}
+
+DecodedInstruction Cpu::decode_at(u32 address)
+{
+	//every execution pays the same fetch, so it is part of the cost
+	DecodedInstruction instruction = decode(fetch_instruction(address));
+	instruction.cycles += (u8)bus->access_time<u32>(address);
+
+	return instruction;
+}
+
+DecodedInstruction& Cpu::fetch_decoded(DecodedInstruction& uncached)
+{
+	//only jr and jalr reach a misaligned pc, the fetch faults and the
+	//handler runs instead. Kernel segment fetches from user mode are not trapped
+	if ((pc & 0x3) != 0) {
+		current_pc = pc;
+		address_error(ExceptionCause::AddressErrorLoad, pc);
+	}
+
+	DecodedInstruction* instruction = lookup_decoded(pc);
+	if (instruction == nullptr) {
+		//not in a cacheable region, decode straight from the bus
+		uncached = decode_at(pc);
+		instruction = &uncached;
+	}
+
+	//a branch only redirects next_pc, its delay
+	//slot is simply the following fetch
+	current_pc = pc;
+	pc = next_pc;
+	next_pc += 4;
+
+	return *instruction;
+}
+
 void Cpu::write_register(u8 register_index, u32 value)
 {
 	if (register_index > 0x1F) {
@@ -78,6 +643,10 @@ void Cpu::write_register(u8 register_index, u32 value)
 	}
 	gprs[register_index] = value;
 	gprs[0x0] = 0x0;
+
+	//the load in flight loses to the write from its delay slot
+	if (register_index == load_delay_register)
+		load_delay_register = 0;
 }
 
 u32 Cpu::read_register(u8 register_index)
@@ -89,23 +658,87 @@ u32 Cpu::read_register(u8 register_index)
 	return gprs[register_index];
 }
 
-void Cpu::handle_branch_delay_slot()
+void Cpu::handle_load_delay_slot(u8 register_index, u32 value)
 {
-	decode_and_execute(next_instruction);
+	//back to back loads to the same register, the later one wins
+	if (register_index == load_delay_register)
+		load_delay_register = 0;
+
+	next_load_delay_register = register_index;
+	next_load_delay_value = value;
 }
 
-void Cpu::handle_load_delay_slot(u8 register_index, u32 value)
+void Cpu::raise_exception(ExceptionCause cause)
 {
-	//save target values of the load
-	lds.register_index = register_index;
-	lds.register_value = value;
+	//an exception in a delay slot returns to the branch
+	bool in_delay_slot = current_pc == delay_slot_address;
+	cop0_epc = in_delay_slot ? current_pc - 4 : current_pc;
+	cop0_cause = (cop0_cause & ~(CAUSE_BD | 0x7C)) | ((u32)cause << 2) | (in_delay_slot ? CAUSE_BD : 0);
+
+	//push kernel mode with interrupts disabled onto the mode stack
+	cop0_sr = (cop0_sr & ~0x3F) | ((cop0_sr << 2) & 0x3F);
+	update_interrupt_pending();
+
+	u32 vector = (cop0_sr & SR_BEV) ? 0xBFC00180 : 0x80000080;
+	pc = vector;
+	next_pc = vector + 4;
+	delay_slot_address = 0;
+}
 
-	load_delay = true;
+void Cpu::address_error(ExceptionCause cause, u32 address)
+{
+	cop0_bad_vaddr = address;
+	raise_exception(cause);
 }
 
-void LoadDelaySlot::save_output()
+void Cpu::update_interrupt_pending()
 {
-	output_gprs[register_index] = register_value;
+	interrupt_pending = (cop0_sr & SR_IEC) != 0 && (cop0_sr & cop0_cause & SR_IM) != 0;
+
+	//linked blocks would not come back to check it before the budget runs out
+	if (interrupt_pending)
+		recompiler.request_exit();
+}
+
+void Cpu::take_interrupt()
+{
+	//between two instructions, a load issued by the last one still lands
+	if (load_delay_register != 0)
+		update_load_delay();
+
+	//pc is next to execute, the delay slot of a branch returns to the branch
+	current_pc = pc;
+	raise_exception(ExceptionCause::Interrupt);
+}
+
+void Cpu::interrupt_line_changed(void* context, bool asserted)
+{
+	Cpu* cpu = (Cpu*)context;
+	if (asserted)
+		cpu->cop0_cause |= CAUSE_IP2;
+	else
+		cpu->cop0_cause &= ~CAUSE_IP2;
+	cpu->update_interrupt_pending();
+}
+
+void Cpu::update_load_delay()
+{
+	//the load issued one instruction ago lands now
+	gprs[load_delay_register] = load_delay_value;
+	gprs[0x0] = 0x0;
+
+	load_delay_register = next_load_delay_register;
+	load_delay_value = next_load_delay_value;
+	next_load_delay_register = 0;
+}
+
+u32 Cpu::read_register_for_merge(u8 register_index)
+{
+	//lwl and lwr merge with a load still in flight to the same register
+	if (register_index == load_delay_register)
+		return load_delay_value;
+
+	return read_register(register_index);
 }
 
 void Cpu::undefined_instruction(InstructionBitField& ibf)
@@ -119,13 +752,16 @@ void Cpu::special(InstructionBitField& ibf)
 	u8 secondary_opcode = (ibf.opcode & 0x3F);
 
 	cycles = secondary_lut[secondary_opcode].cycles;
-	secondary_lut[secondary_opcode].execute(ibf);
+	(this->*secondary_lut[secondary_opcode].execute)(ibf);
 }
 
 void Cpu::bcond(InstructionBitField& ibf)
 {
+	//raise_exception checks it to tell the delay slot apart
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
-	u32 register_rs = read_register(rs);
+	s32 register_rs = (s32)read_register(rs);
 
 	switch ((ibf.opcode >> 16) & 0x1F) {
 		case 0b00000: //bltz
@@ -151,40 +787,45 @@ void Cpu::bcond(InstructionBitField& ibf)
 
 void Cpu::j(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	//align target address (shift left 2) to combine with upper 4 bits of PC
 	u32 target = ibf.immediate_26();
-	pc = (pc & 0xF0000000) | (target << 2);
+	target = (pc & 0xF0000000) | (target << 2);
 
-	handle_branch_delay_slot();
+	next_pc = target;
 }
 
 void Cpu::jal(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u32 target = ibf.immediate_26();
 
 	//store address (return address) of instruction after the delay slot
 	//into the register ra
 	write_register(RA, pc + 4); 
 	
-	pc = (pc & 0xF0000000) | (target << 2);
+	target = (pc & 0xF0000000) | (target << 2);
 
-	handle_branch_delay_slot();
+	next_pc = target;
 }
 
 void Cpu::branch(InstructionBitField& ibf)
 {
-	u32 imm = (s16)ibf.immediate_16();
-	imm = sext_32(imm, 16);
+	u32 imm = ibf.immediate_se();
 	imm <<= 2;
 
-	u32 delay_slot_address = pc;
-	u32 target_address = delay_slot_address + imm;
+	//relative to the delay slot
+	u32 target_address = pc + imm;
 
-	pc = target_address;
+	next_pc = target_address;
 }
 
 void Cpu::beq(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
 	u8 rt = ibf.rt();
 
@@ -197,6 +838,8 @@ void Cpu::beq(InstructionBitField& ibf)
 
 void Cpu::bne(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
 	u8 rt = ibf.rt();
 
@@ -209,8 +852,10 @@ void Cpu::bne(InstructionBitField& ibf)
 
 void Cpu::blez(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
-	u32 register_rs = read_register(rs);
+	s32 register_rs = (s32)read_register(rs);
 
 	if (register_rs <= 0)
 		branch(ibf);
@@ -218,17 +863,82 @@ void Cpu::blez(InstructionBitField& ibf)
 
 void Cpu::bgtz(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
-	u32 register_rs = read_register(rs);
+	s32 register_rs = (s32)read_register(rs);
 
 	if (register_rs > 0)
 		branch(ibf);
 }
 
+void Cpu::cop0(InstructionBitField& ibf)
+{
+	//user mode needs cu0 for any cop0 instruction
+	if ((cop0_sr & (SR_KUC | SR_CU0)) == SR_KUC) {
+		cop0_cause &= ~(3 << 28); //coprocessor number
+		raise_exception(ExceptionCause::CoprocessorUnusable);
+		return;
+	}
+
+	switch (ibf.rs()) {
+		case 0x00: mfc0(ibf); break;
+		case 0x04: mtc0(ibf); break;
+		case 0x10: {
+			if ((ibf.opcode & 0x3F) == 0x10) {
+				rfe(ibf);
+				break;
+			}
+			undefined_instruction(ibf);
+		}
+		break;
+		default: undefined_instruction(ibf); break;
+	}
+}
+
+void Cpu::mfc0(InstructionBitField& ibf)
+{
+	u32 value = 0;
+	switch (ibf.rd()) {
+		case 8: value = cop0_bad_vaddr; break;
+		case 12: value = cop0_sr; break;
+		case 13: value = cop0_cause; break;
+		case 14: value = cop0_epc; break;
+		case 15: value = 0x00000002; break; //prid
+		default: break; //breakpoint registers read as zero
+	}
+
+	handle_load_delay_slot(ibf.rt(), value);
+}
+
+void Cpu::mtc0(InstructionBitField& ibf)
+{
+	u32 value = read_register(ibf.rt());
+	switch (ibf.rd()) {
+		case 12: {
+			cop0_sr = value;
+			update_interrupt_pending();
+		}
+		break;
+		case 13: {
+			cop0_cause = (cop0_cause & ~CAUSE_SOFTWARE_INTERRUPTS) | (value & CAUSE_SOFTWARE_INTERRUPTS);
+			update_interrupt_pending();
+		}
+		break;
+		default: break; //breakpoint registers, bad vaddr, epc and prid are read only
+	}
+}
+
+void Cpu::rfe(InstructionBitField& ibf)
+{
+	//pop the mode stack, the old pair stays
+	cop0_sr = (cop0_sr & ~0xF) | ((cop0_sr >> 2) & 0xF);
+	update_interrupt_pending();
+}
+
 void Cpu::addi(InstructionBitField& ibf)
 {
-	u32 imm_se = (s16)ibf.immediate_16();
-	imm_se = sext_32(imm_se, 16);
+	u32 imm_se = ibf.immediate_se();
 
 	u8 rt = ibf.rt();
 	u8 rs = ibf.rs();
@@ -236,14 +946,18 @@ void Cpu::addi(InstructionBitField& ibf)
 	u32 register_rs = read_register(rs);
 	u32 result = register_rs + imm_se;
 
+	//trap on two's complement overflow, rt is left alone
+	if ((~(register_rs ^ imm_se) & (register_rs ^ result) & 0x80000000) != 0) {
+		raise_exception(ExceptionCause::Overflow);
+		return;
+	}
+
 	write_register(rt, result);
-	//trap on two's complement overflow
 }
 
 void Cpu::addiu(InstructionBitField& ibf)
 {
-	u32 imm_se = (s16)ibf.immediate_16();
-	imm_se = sext_32(imm_se, 16);
+	u32 imm_se = ibf.immediate_se();
 
 	u8 rt = ibf.rt();
 	u8 rs = ibf.rs();
@@ -256,8 +970,7 @@ void Cpu::addiu(InstructionBitField& ibf)
 
 void Cpu::slti(InstructionBitField& ibf)
 {
-	s32 imm_se = (s16)ibf.immediate_16();
-	imm_se = sext_32(imm_se, 16);
+	s32 imm_se = (s32)ibf.immediate_se();
 
 	u8 rt = ibf.rt();
 	u8 rs = ibf.rs();
@@ -271,8 +984,7 @@ void Cpu::slti(InstructionBitField& ibf)
 
 void Cpu::sltiu(InstructionBitField& ibf)
 {
-	u32 imm_se = (s16)ibf.immediate_16();
-	imm_se = sext_32(imm_se, 16);
+	u32 imm_se = ibf.immediate_se();
 
 	u8 rt = ibf.rt();
 	u8 rs = ibf.rs();
@@ -330,10 +1042,70 @@ void Cpu::lui(InstructionBitField& ibf)
 	write_register(rt, result);
 }
 
+bool Cpu::enter_fused(InstructionBitField& ibf)
+{
+	//in a delay slot the instruction after lui is not the next one
+	if (pc != current_pc + 4)
+		return false;
+
+	//what execute does between the two
+	if ((load_delay_register | next_load_delay_register) != 0)
+		update_load_delay();
+
+	current_pc = pc;
+	pc = next_pc;
+	next_pc += 4;
+	stall_cycles += ibf.fused_cycles;
+	return true;
+}
+
+void Cpu::lui_addiu(InstructionBitField& ibf)
+{
+	lui(ibf);
+	if (enter_fused(ibf))
+		write_register(ibf.rd(), ((u32)ibf.immediate_16() << 16) + ibf.immediate_se());
+}
+
+void Cpu::lui_ori(InstructionBitField& ibf)
+{
+	lui(ibf);
+	if (enter_fused(ibf))
+		write_register(ibf.rd(), ((u32)ibf.immediate_16() << 16) | (ibf.immediate_se() & 0xFFFF));
+}
+
+template <u8 Policy>
+void Cpu::lui_lw(InstructionBitField& ibf)
+{
+	lui(ibf);
+	if (!enter_fused(ibf))
+		return;
+
+	u32 target_address = ((u32)ibf.immediate_16() << 16) + ibf.immediate_se();
+	if ((target_address & 0x3) != 0) {
+		address_error(ExceptionCause::AddressErrorLoad, target_address);
+		return;
+	}
+
+	u32 word = load<Policy, u32>(target_address);
+
+	handle_load_delay_slot(ibf.rd(), word);
+}
+
+template <u8 Policy, typename T> T Cpu::load(u32 address)
+{
+	stall_cycles += bus->access_time<T>(address);
+	return bus->read<T, Policy>(address);
+}
+
+template <u8 Policy, typename T> void Cpu::store(u32 address, T value)
+{
+	stall_cycles += bus->access_time<T>(address);
+	bus->write<T, Policy>(address, value);
+}
+
 u32 Cpu::calculate_load_store_target_address(InstructionBitField& ibf)
 {
-	u32 imm_se = (s16)ibf.immediate_16();
-	imm_se = sext_32(imm_se, 16);
+	u32 imm_se = ibf.immediate_se();
 
 	u8 rs = ibf.rs();
 
@@ -343,74 +1115,82 @@ u32 Cpu::calculate_load_store_target_address(InstructionBitField& ibf)
 	return target_address;
 }
 
-void Cpu::load(InstructionBitField& ibf)
-{
-	switch ((ibf.opcode >> 26) & 0x7) {
-		case 0b000: lb(ibf); break;
-		case 0b001: lh(ibf); break;
-		case 0b010: lwl(ibf); break;
-		case 0b011: lw(ibf); break;
-		case 0b100: lbu(ibf); break;
-		case 0b101: lhu(ibf); break;
-		case 0b110: lwr(ibf); break;
-	}
-}
-
+template <u8 Policy>
 void Cpu::lb(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 
 	//read byte and sign extend it
-	u32 byte = (s8)bus->read_u8(target_address);
+	u32 byte = (s8)load<Policy, u8>(target_address);
 	byte = sext_32(byte, 8);
 
 	handle_load_delay_slot(ibf.rt(), byte);
 }
 
+template <u8 Policy>
 void Cpu::lbu(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 
 	//read byte and zero extend
-	u32 byte = bus->read_u8(target_address);
+	u32 byte = load<Policy, u8>(target_address);
 	
 	handle_load_delay_slot(ibf.rt(), byte);
 }
 
+template <u8 Policy>
 void Cpu::lh(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 
-	u32 halfword = (s16)bus->read_u16(target_address);
+	if ((target_address & 0x1) != 0) {
+		address_error(ExceptionCause::AddressErrorLoad, target_address);
+		return;
+	}
+
+	u32 halfword = (s16)load<Policy, u16>(target_address);
 	halfword = sext_32(halfword, 16);
 
 	handle_load_delay_slot(ibf.rt(), halfword);
 }
 
+template <u8 Policy>
 void Cpu::lhu(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 halfword = bus->read_u16(target_address);
+	if ((target_address & 0x1) != 0) {
+		address_error(ExceptionCause::AddressErrorLoad, target_address);
+		return;
+	}
+
+	u32 halfword = load<Policy, u16>(target_address);
 
 	handle_load_delay_slot(ibf.rt(), halfword);
 }
 
+template <u8 Policy>
 void Cpu::lw(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 word = bus->read_u32(target_address);
+	if ((target_address & 0x3) != 0) {
+		address_error(ExceptionCause::AddressErrorLoad, target_address);
+		return;
+	}
+
+	u32 word = load<Policy, u32>(target_address);
 
 	handle_load_delay_slot(ibf.rt(), word);
 }
 
+template <u8 Policy>
 void Cpu::lwl(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 	//force align address
 	u32 aligned_address = target_address & 0xFFFFFFFC;
 
-	u32 word = bus->read_u32(aligned_address);
-	u32 register_rt = read_register(ibf.rt());
+	u32 word = load<Policy, u32>(aligned_address);
+	u32 register_rt = read_register_for_merge(ibf.rt());
 
 	//determine value based on alignment
 	u32 loaded_value = word;
@@ -424,13 +1204,14 @@ void Cpu::lwl(InstructionBitField& ibf)
 	handle_load_delay_slot(ibf.rt(), loaded_value);
 }
 
+template <u8 Policy>
 void Cpu::lwr(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 	u32 aligned_address = target_address & 0xFFFFFFFC;
 
-	u32 word = bus->read_u32(target_address);
-	u32 register_rt = read_register(ibf.rt());
+	u32 word = load<Policy, u32>(aligned_address);
+	u32 register_rt = read_register_for_merge(ibf.rt());
 
 	u32 loaded_value = word;
 	switch (target_address & 0x3) {
@@ -443,47 +1224,41 @@ void Cpu::lwr(InstructionBitField& ibf)
 	handle_load_delay_slot(ibf.rt(), loaded_value);
 }
 
-void Cpu::store(InstructionBitField& ibf)
-{
-	switch ((ibf.opcode >> 26) & 0x7) {
-		case 0b000: sb(ibf); break;
-		case 0b001: sh(ibf); break;
-		case 0b010: swl(ibf); break;
-		case 0b011: sw(ibf); break;
-		case 0b110: swr(ibf); break;
-	}
-}
-
+template <u8 Policy>
 void Cpu::sb(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
 	u32 register_rt = read_register(ibf.rt());
 
 	u8 byte = register_rt & 0xFF;
-	bus->write_u8(target_address, byte);
+	store<Policy, u8>(target_address, byte);
 }
 
+template <u8 Policy>
 void Cpu::sh(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 register_rt = read_register(ibf.rt());
+	if ((target_address & 0x1) != 0) {
+		address_error(ExceptionCause::AddressErrorStore, target_address);
+		return;
+	}
 
+	u32 register_rt = read_register(ibf.rt());
 	u16 halfword = register_rt & 0xFFFF;
-	bus->write_u16(target_address, halfword);
+	store<Policy, u16>(target_address, halfword);
 }
 
+template <u8 Policy>
 void Cpu::swl(InstructionBitField& ibf)
 {
-	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 register_rt = read_register(ibf.rt());
-
 	u32 target_address = calculate_load_store_target_address(ibf);
 	//force align address
 	u32 aligned_address = target_address & 0xFFFFFFFC;
 
 	u32 register_rt = read_register(ibf.rt());
 	//read current value at aligned address and update
-	//the value with register rt
+	//the value with register rt, the hardware masks the write
+	//instead so only the store pays wait states
 	u32 curr_mem_value = bus->read_u32(aligned_address);
 
 	//determine value based on alignment
@@ -495,30 +1270,34 @@ void Cpu::swl(InstructionBitField& ibf)
 		case 0b11: stored_value = ((curr_mem_value & 0x00000000) | (register_rt >> 0)); break;
 	}
 
-	bus->write_u32(aligned_address, stored_value);
+	store<Policy, u32>(aligned_address, stored_value);
 }
 
+template <u8 Policy>
 void Cpu::sw(InstructionBitField& ibf)
 {
 	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 register_rt = read_register(ibf.rt());
+	if ((target_address & 0x3) != 0) {
+		address_error(ExceptionCause::AddressErrorStore, target_address);
+		return;
+	}
 
+	u32 register_rt = read_register(ibf.rt());
 	u32 word = register_rt & 0xFFFFFFFF;
-	bus->write_u32(target_address, word);
+	store<Policy, u32>(target_address, word);
 }
 
+template <u8 Policy>
 void Cpu::swr(InstructionBitField& ibf)
 {
-	u32 target_address = calculate_load_store_target_address(ibf);
-	u32 register_rt = read_register(ibf.rt());
-
 	u32 target_address = calculate_load_store_target_address(ibf);
 	//force align address
 	u32 aligned_address = target_address & 0xFFFFFFFC;
 
 	u32 register_rt = read_register(ibf.rt());
 	//read current value at aligned address and update
-	//the value with register rt
+	//the value with register rt, the hardware masks the write
+	//instead so only the store pays wait states
 	u32 curr_mem_value = bus->read_u32(aligned_address);
 
 	//determine value based on alignment
@@ -530,28 +1309,235 @@ void Cpu::swr(InstructionBitField& ibf)
 		case 0b11: stored_value = ((curr_mem_value & 0x00FFFFFF) | (register_rt << 24)); break;
 	}
 
-	bus->write_u32(aligned_address, stored_value);
+	store<Policy, u32>(aligned_address, stored_value);
+}
+
+//memory_luts and the recompiler slow paths refer to every policy
+#define INSTANTIATE_MEMORY_ACCESS(policy) \
+	template u8 Cpu::load<policy, u8>(u32 address); \
+	template u16 Cpu::load<policy, u16>(u32 address); \
+	template u32 Cpu::load<policy, u32>(u32 address); \
+	template void Cpu::store<policy, u8>(u32 address, u8 value); \
+	template void Cpu::store<policy, u16>(u32 address, u16 value); \
+	template void Cpu::store<policy, u32>(u32 address, u32 value); \
+	template void Cpu::lb<policy>(InstructionBitField& ibf); \
+	template void Cpu::lbu<policy>(InstructionBitField& ibf); \
+	template void Cpu::lh<policy>(InstructionBitField& ibf); \
+	template void Cpu::lhu<policy>(InstructionBitField& ibf); \
+	template void Cpu::lw<policy>(InstructionBitField& ibf); \
+	template void Cpu::lwl<policy>(InstructionBitField& ibf); \
+	template void Cpu::lwr<policy>(InstructionBitField& ibf); \
+	template void Cpu::sb<policy>(InstructionBitField& ibf); \
+	template void Cpu::sh<policy>(InstructionBitField& ibf); \
+	template void Cpu::swl<policy>(InstructionBitField& ibf); \
+	template void Cpu::sw<policy>(InstructionBitField& ibf); \
+	template void Cpu::swr<policy>(InstructionBitField& ibf); \
+	template void Cpu::lui_lw<policy>(InstructionBitField& ibf);
+
+INSTANTIATE_MEMORY_ACCESS(BUS_PLAIN)
+INSTANTIATE_MEMORY_ACCESS(BUS_WATCHPOINTS)
+INSTANTIATE_MEMORY_ACCESS(BUS_TRACING)
+INSTANTIATE_MEMORY_ACCESS(BUS_WATCHPOINTS | BUS_TRACING)
+#undef INSTANTIATE_MEMORY_ACCESS
+
+void Cpu::sll(InstructionBitField& ibf)
+{
+	u8 rd = ibf.rd();
+	u8 rt = ibf.rt();
+
+	u32 register_rt = read_register(rt);
+	u32 result = register_rt << ibf.shamt();
+
+	write_register(rd, result);
+}
+
+void Cpu::nop(InstructionBitField& ibf)
+{
+
+}
+
+void Cpu::syscall(InstructionBitField& ibf)
+{
+	raise_exception(ExceptionCause::Syscall);
+}
+
+void Cpu::breakpoint(InstructionBitField& ibf)
+{
+	raise_exception(ExceptionCause::Breakpoint);
+}
+
+void Cpu::add(InstructionBitField& ibf)
+{
+	u32 register_rs = read_register(ibf.rs());
+	u32 register_rt = read_register(ibf.rt());
+	u32 result = register_rs + register_rt;
+
+	if ((~(register_rs ^ register_rt) & (register_rs ^ result) & 0x80000000) != 0) {
+		raise_exception(ExceptionCause::Overflow);
+		return;
+	}
+
+	write_register(ibf.rd(), result);
+}
+
+void Cpu::sub(InstructionBitField& ibf)
+{
+	u32 register_rs = read_register(ibf.rs());
+	u32 register_rt = read_register(ibf.rt());
+	u32 result = register_rs - register_rt;
+
+	//operands of different signs and the sign flipped from rs
+	if (((register_rs ^ register_rt) & (register_rs ^ result) & 0x80000000) != 0) {
+		raise_exception(ExceptionCause::Overflow);
+		return;
+	}
+
+	write_register(ibf.rd(), result);
+}
+
+u64 Cpu::current_cycle()
+{
+	u64 cycle = cycle_count + run_elapsed + stall_cycles + cycle_offset;
+	if (mode == ExecutionMode::Recompiler)
+		cycle += recompiler.elapsed();
+
+	//execute_block charges the block once it is done
+	if (executing_block != nullptr) {
+		u32 index = (current_pc - executing_block->address) / 4;
+		for (u32 i = 0; i < index; i++)
+			cycle += executing_block->instructions[i].cycles;
+	}
+
+	return cycle;
+}
+
+u64 Cpu::trace_cycle(void* context)
+{
+	return ((Cpu*)context)->current_cycle();
+}
+
+void Cpu::wait_for_muldiv()
+{
+	u64 cycle = current_cycle();
+	if (muldiv_ready > cycle)
+		stall_cycles += (u32)(muldiv_ready - cycle);
+}
+
+//the multiplier stops early on small rs, 6, 9 or 13 cycles
+//for up to 11, 20 or 32 significant bits
+static u32 multiply_latency(u32 magnitude)
+{
+	if (magnitude < 0x800)
+		return 6;
+	if (magnitude < 0x100000)
+		return 9;
+	return 13;
+}
+
+void Cpu::mfhi(InstructionBitField& ibf)
+{
+	wait_for_muldiv();
+	write_register(ibf.rd(), hi);
+}
+
+void Cpu::mthi(InstructionBitField& ibf)
+{
+	hi = read_register(ibf.rs());
+}
+
+void Cpu::mflo(InstructionBitField& ibf)
+{
+	wait_for_muldiv();
+	write_register(ibf.rd(), lo);
+}
+
+void Cpu::mtlo(InstructionBitField& ibf)
+{
+	lo = read_register(ibf.rs());
+}
+
+void Cpu::mult(InstructionBitField& ibf)
+{
+	s32 register_rs = (s32)read_register(ibf.rs());
+	s32 register_rt = (s32)read_register(ibf.rt());
+	u64 result = (u64)((s64)register_rs * register_rt);
+	hi = (u32)(result >> 32);
+	lo = (u32)result;
+
+	//negative rs counts its leading ones
+	u32 magnitude = register_rs < 0 ? ~(u32)register_rs : (u32)register_rs;
+	muldiv_ready = current_cycle() + multiply_latency(magnitude);
+}
+
+void Cpu::multu(InstructionBitField& ibf)
+{
+	u32 register_rs = read_register(ibf.rs());
+	u32 register_rt = read_register(ibf.rt());
+	u64 result = (u64)register_rs * register_rt;
+	hi = (u32)(result >> 32);
+	lo = (u32)result;
+
+	muldiv_ready = current_cycle() + multiply_latency(register_rs);
+}
+
+void Cpu::div(InstructionBitField& ibf)
+{
+	s32 register_rs = (s32)read_register(ibf.rs());
+	s32 register_rt = (s32)read_register(ibf.rt());
+
+	//neither case traps, the results are what the divider leaves behind
+	if (register_rt == 0) {
+		hi = (u32)register_rs;
+		lo = register_rs < 0 ? 1 : 0xFFFFFFFF;
+	}
+	else if ((u32)register_rs == 0x80000000 && register_rt == -1) {
+		hi = 0;
+		lo = 0x80000000;
+	}
+	else {
+		hi = (u32)(register_rs % register_rt);
+		lo = (u32)(register_rs / register_rt);
+	}
+
+	muldiv_ready = current_cycle() + DIVIDE_LATENCY;
+}
+
+void Cpu::divu(InstructionBitField& ibf)
+{
+	u32 register_rs = read_register(ibf.rs());
+	u32 register_rt = read_register(ibf.rt());
+
+	if (register_rt == 0) {
+		hi = register_rs;
+		lo = 0xFFFFFFFF;
+	}
+	else {
+		hi = register_rs % register_rt;
+		lo = register_rs / register_rt;
+	}
+
+	muldiv_ready = current_cycle() + DIVIDE_LATENCY;
 }
 
 void Cpu::jr(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
 	u32 target = read_register(rs);
 
-	pc = target;
-
-	handle_branch_delay_slot();
+	next_pc = target;
 }
 
 void Cpu::jalr(InstructionBitField& ibf)
 {
+	delay_slot_address = current_pc + 4;
+
 	u8 rs = ibf.rs();
 	u8 rd = ibf.rd();
 
-	write_register(rd, pc + 4);
-
 	u32 target = read_register(rs);
-	pc = target;
+	write_register(rd, pc + 4);
 
-	handle_branch_delay_slot();
+	next_pc = target;
 }
@@ -1,61 +1,137 @@
 #pragma once
 #include "Common.h"
+#include "Bus.h"
+#include "CodeCache.h"
+#include "Recompiler.h"
 #include <array>
-#include <functional>
+#include <vector>
 
-#define b(x) std::bind(x, this, std::placeholders::_1)
-
-struct Bus;
+struct Instruction;
+struct DecodedInstruction;
 
 enum RegisterAlias : u8{
 	RA = 31
 };
 
-struct LoadDelaySlot {
-	void save_output();
-	u32 output_gprs[0x20];
-	u8 register_index; //target register index to save
-	u32 register_value; //loaded value to save
+//handlers jump straight to the next handler through label addresses
+#if defined(__GNUC__)
+#define CPU_THREADED_DISPATCH
+#endif
+
+enum class ExecutionMode : u8 {
+	Interpreter, //one instruction per dispatch
+	ThreadedInterpreter, //Interpreter with computed goto dispatch, gcc and clang only
+	CachedInterpreter, //one basic block per dispatch
+	Recompiler //x86-64 host code per basic block, cached interpreter elsewhere
 };
 
-struct Load {
-	u8 register_index;
-	u32 register_value;
+//exception codes as stored in cause
+enum class ExceptionCause : u8 {
+	Interrupt = 0x0,
+	AddressErrorLoad = 0x4,
+	AddressErrorStore = 0x5,
+	Syscall = 0x8,
+	Breakpoint = 0x9,
+	CoprocessorUnusable = 0xB,
+	Overflow = 0xC
 };
 
+//cop0 status register
+#define SR_IEC (1 << 0) //interrupts enabled
+#define SR_KUC (1 << 1) //user mode
+#define SR_IM (0xFF << 8) //interrupt mask, same bits as cause.IP
+#define SR_BEV (1 << 22) //exception vectors in the bios
+#define SR_CU0 (1 << 28) //cop0 usable in user mode
+
+//cop0 cause register
+#define CAUSE_SOFTWARE_INTERRUPTS (3 << 8) //the only writable bits
+#define CAUSE_IP2 (1 << 10) //driven by the interrupt controller
+#define CAUSE_BD (1 << 31)
+
+//cycles until hi and lo hold the quotient, multiplies depend on rs
+#define DIVIDE_LATENCY 36
+
+//longest block still checked for an idle loop
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8
+
+//fields are extracted once when the instruction is decoded
 struct InstructionBitField {
-	u8 rs();
-	u8 rt();
-	u8 rd();
-	u16 immediate_16();
-	u32 immediate_26();
-	u32 opcode;
-};
+	InstructionBitField() = default;
+	InstructionBitField(u32 opcode);
 
-struct Instruction {
-	std::function<void(InstructionBitField& ibf)> execute;
-	u8 cycles;
+	u8 rs() { return register_s; }
+	u8 rt() { return register_t; }
+	u8 rd() { return register_d; }
+	u16 immediate_16() { return opcode & 0xFFFF; }
+	u32 immediate_26() { return opcode & 0x3FFFFFF; }
+	u32 immediate_se() { return immediate_sign_extended; } //sign extended 16 bit immediate
+	u8 shamt() { return (opcode >> 6) & 0x1F; }
+
+	u32 opcode;
+	u32 immediate_sign_extended;
+	u8 register_s;
+	u8 register_t;
+	u8 register_d;
+	//a lui fused with the instruction after it keeps that one's rt in register_d
+	//and its immediate in immediate_sign_extended, this is its cost. 0 when not fused
+	u8 fused_cycles;
 };
 
 struct Cpu {
-	Cpu();
+	friend struct Recompiler;
+
+	Cpu(Bus* bus);
 	~Cpu();
 
 	void reset();
-	void map_opcodes();
+	void set_execution_mode(ExecutionMode mode);
+	void set_pc(u32 address);
+	void attach_tracer(MemoryTracer* tracer); //records carry current_pc and current_cycle
+
+	u32 run(u32 cycle_budget);
+	u32 clock();
+#if defined(CPU_THREADED_DISPATCH)
+	template <u8 Policy> u32 run_threaded(u32 cycle_budget);
+#endif
+	u32 execute_block(u32 cycle_budget); //idle loops may be skipped up to cycle_budget
+	BasicBlock* compile_block(u32 address);
+	void detect_idle_loop(BasicBlock* block);
+	u32 skip_idle_loop(const BasicBlock* block, u32 iteration_cycles, u32 cycle_budget);
 
-	u8 clock();
 	void decode_and_execute(u32 opcode);
+	void execute(DecodedInstruction& instruction);
+	DecodedInstruction decode(u32 opcode); //load and store handlers of the bus policy
+	DecodedInstruction decode_at(u32 address); //cycles include the fetch wait states
+	static bool is_branch(u32 opcode);
+	static bool is_load(u32 opcode);
+	static bool is_muldiv(u32 opcode); //reads or starts the multiply/divide unit
+	void fuse(DecodedInstruction& instruction, u32 address);
+	static DecodedInstruction unfuse(const DecodedInstruction& instruction);
 
-	u32 read_u32();
-	u32 fetch_u32();
+	u32 fetch_instruction(u32 address);
+	DecodedInstruction* lookup_decoded(u32 address);
+	DecodedInstruction& fetch_decoded(DecodedInstruction& uncached);
 
 	void write_register(u8 register_index, u32 value);
 	u32 read_register(u8 register_index);
 
-	Load handle_load();
-	void handle_branch_delay_slot();
+	void raise_exception(ExceptionCause cause);
+	void address_error(ExceptionCause cause, u32 address);
+
+	//interrupt_pending is recomputed whenever sr, cause or the line change,
+	//the execution loops only test it between instructions or blocks
+	void update_interrupt_pending();
+	void take_interrupt();
+	static void interrupt_line_changed(void* context, bool asserted);
+
+	//cycle the executing instruction issues at, whatever the execution mode
+	u64 current_cycle();
+	static u64 trace_cycle(void* context);
+	void wait_for_muldiv(); //stalls until hi and lo are ready
+
 	void handle_load_delay_slot(u8 register_index, u32 value);
+	void update_load_delay();
+	u32 read_register_for_merge(u8 register_index);
 
 	void undefined_instruction(InstructionBitField& ibf);
 	void special(InstructionBitField& ibf); //secondary opcode
@@ -70,6 +146,11 @@ struct Cpu {
 	void blez(InstructionBitField& ibf);
 	void bgtz(InstructionBitField& ibf);
 
+	void cop0(InstructionBitField& ibf);
+	void mfc0(InstructionBitField& ibf);
+	void mtc0(InstructionBitField& ibf);
+	void rfe(InstructionBitField& ibf);
+
 	void addi(InstructionBitField& ibf);
 	void addiu(InstructionBitField& ibf);
 	void slti(InstructionBitField& ibf);
@@ -79,39 +160,125 @@ struct Cpu {
 	void xori(InstructionBitField& ibf);
 	void lui(InstructionBitField& ibf);
 
+	//lui and the instruction after it in one dispatch, see fuse
+	bool enter_fused(InstructionBitField& ibf);
+	void lui_addiu(InstructionBitField& ibf);
+	void lui_ori(InstructionBitField& ibf);
+	template <u8 Policy> void lui_lw(InstructionBitField& ibf);
+
+	//picks the handlers matching what the bus has to check, see BusPolicy
+	void set_bus_policy(u8 policy);
+
+	//bus accesses charging the wait states of the region
+	template <u8 Policy, typename T> T load(u32 address);
+	template <u8 Policy, typename T> void store(u32 address, T value);
+
 	u32 calculate_load_store_target_address(InstructionBitField& ibf);
-	void load(InstructionBitField& ibf);
-	void lb(InstructionBitField& ibf);
-	void lbu(InstructionBitField& ibf);
-	void lh(InstructionBitField& ibf);
-	void lhu(InstructionBitField& ibf);
-	void lw(InstructionBitField& ibf);
-	void lwl(InstructionBitField& ibf);
-	void lwr(InstructionBitField& ibf);
-
-	void store(InstructionBitField& ibf);
-	void sb(InstructionBitField& ibf);
-	void sh(InstructionBitField& ibf);
-	void swl(InstructionBitField& ibf);
-	void sw(InstructionBitField& ibf);
-	void swr(InstructionBitField& ibf);
+	template <u8 Policy> void lb(InstructionBitField& ibf);
+	template <u8 Policy> void lbu(InstructionBitField& ibf);
+	template <u8 Policy> void lh(InstructionBitField& ibf);
+	template <u8 Policy> void lhu(InstructionBitField& ibf);
+	template <u8 Policy> void lw(InstructionBitField& ibf);
+	template <u8 Policy> void lwl(InstructionBitField& ibf);
+	template <u8 Policy> void lwr(InstructionBitField& ibf);
+
+	template <u8 Policy> void sb(InstructionBitField& ibf);
+	template <u8 Policy> void sh(InstructionBitField& ibf);
+	template <u8 Policy> void swl(InstructionBitField& ibf);
+	template <u8 Policy> void sw(InstructionBitField& ibf);
+	template <u8 Policy> void swr(InstructionBitField& ibf);
 
 	//secondary
+	void sll(InstructionBitField& ibf);
+	void nop(InstructionBitField& ibf); //sll to r0
 	void jr(InstructionBitField& ibf);
 	void jalr(InstructionBitField& ibf);
-	
+	void syscall(InstructionBitField& ibf);
+	void breakpoint(InstructionBitField& ibf); //break
+	void add(InstructionBitField& ibf);
+	void sub(InstructionBitField& ibf);
+	void mfhi(InstructionBitField& ibf);
+	void mthi(InstructionBitField& ibf);
+	void mflo(InstructionBitField& ibf);
+	void mtlo(InstructionBitField& ibf);
+	void mult(InstructionBitField& ibf);
+	void multu(InstructionBitField& ibf);
+	void div(InstructionBitField& ibf);
+	void divu(InstructionBitField& ibf);
+
 
 private:
 	u32 gprs[0x20];
-	u32 pc;
+	u32 pc; //address of the instruction being fetched
+	u32 next_pc; //pc after it, branches write their target here
+	u32 current_pc; //address of the instruction being executed
+	u32 delay_slot_address = 0; //of the last branch, exceptions there restart at the branch
 	u32 hi, lo; //mult/divide results
-	LoadDelaySlot lds;
-	bool load_delay = false;
+	u64 muldiv_ready = 0; //cycle the last mult or div finishes, only reads of hi and lo wait for it
 
-	std::array<Instruction, 0x3F> primary_lut;
-	std::array<Instruction, 0x3F> secondary_lut;
+	//a load lands after the instruction in its delay slot, register 0 means
+	//none is pending. Writing the register in the slot cancels the load
+	u8 load_delay_register = 0;
+	u32 load_delay_value = 0;
+	u8 next_load_delay_register = 0; //issued by the executing instruction
+	u32 next_load_delay_value = 0;
+
+	//coprocessor 0, the breakpoint registers are not emulated
+	u32 cop0_bad_vaddr = 0;
+	u32 cop0_sr = 0;
+	u32 cop0_cause = 0;
+	u32 cop0_epc = 0;
+	bool interrupt_pending = false; //enabled in sr and raised in cause
+
+	//dispatch tables, constant initialized in Opcodes.cpp
+	static const std::array<Instruction, 0x40> primary_lut;
+	static const std::array<Instruction, 0x40> secondary_lut;
+	//loads and stores 0x20-0x2F per bus policy, decode takes them from here
+	static const std::array<std::array<Instruction, 0x10>, BUS_POLICY_COUNT> memory_luts;
+	static const std::array<void (Cpu::*)(InstructionBitField&), BUS_POLICY_COUNT> fused_loads;
+	u8 bus_policy = BUS_PLAIN;
+	u32 policy_generation = 0; //of the bus when the policy was picked
 	u8 cycles = 0;
-	u32 next_instruction = 0;
+	u32 stall_cycles = 0; //bus wait states on top of cycles, taken by whoever counts them
+	u64 cycle_count = 0; //elapsed cycles, advanced once per run
+	u32 run_elapsed = 0; //of the current run, up to the instruction or block being dispatched
+	s32 cycle_offset = 0; //of the executing instruction from what recompiled blocks charged
+	const BasicBlock* executing_block = nullptr; //by execute_block
 
+	//host memory of the region instructions were last fetched from
+	const u8* fetch_host = nullptr;
+	u32 fetch_start = 0; //guest address of fetch_host
+	u32 fetch_size = 0;
+
+	ExecutionMode mode = ExecutionMode::Interpreter;
+	CodeCache code_cache;
 	Bus* bus;
+	Recompiler recompiler;
+};
+
+struct Instruction {
+	void (Cpu::*execute)(InstructionBitField& ibf);
+	u8 cycles;
+};
+
+//an instruction with its handler resolved through both tables
+struct DecodedInstruction {
+	void (Cpu::*execute)(InstructionBitField& ibf);
+	InstructionBitField ibf;
+	u8 cycles; //base cost plus the fetch wait states of its region
+};
+
+//a straight run of instructions ending with a branch and,
+//when it sits on the same page, its delay slot
+struct BasicBlock {
+	u32 address;
+	u32 cycles; //summed when the block is compiled
+	u32 generation; //page generation the block was compiled against
+	std::vector<DecodedInstruction> instructions;
+	const u8* code = nullptr; //recompiled host code
+
+	//branches back to its own start and only ever computes the same values
+	//from one memory read, see Cpu::detect_idle_loop
+	bool idle_loop = false;
+	s32 idle_load = -1; //index of that read, -1 for none
 };
\ No newline at end of file
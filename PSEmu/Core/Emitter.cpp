@@ -0,0 +1,359 @@
+#include "Emitter.h"
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+X64Emitter::X64Emitter()
+	:code(nullptr), capacity(0), size(0)
+{
+
+}
+
+X64Emitter::~X64Emitter()
+{
+	if (code == nullptr)
+		return;
+#if defined(_WIN32)
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, capacity);
+#endif
+}
+
+bool X64Emitter::allocate(u32 capacity)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+#if defined(_WIN32)
+	void* memory = VirtualAlloc(nullptr, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (memory == nullptr) {
+#else
+	void* memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+#endif
+		printf("!!Failed to allocate %u bytes of executable memory!!\n", capacity);
+		return false;
+	}
+
+	code = (u8*)memory;
+	this->capacity = capacity;
+	size = 0;
+	return true;
+#else
+	//host is not x86-64
+	return false;
+#endif
+}
+
+void X64Emitter::reset()
+{
+	size = 0;
+}
+
+u8* X64Emitter::current()
+{
+	return code + size;
+}
+
+u32 X64Emitter::free_space()
+{
+	return capacity - size;
+}
+
+void X64Emitter::emit_u8(u8 value)
+{
+	code[size++] = value;
+}
+
+void X64Emitter::emit_u32(u32 value)
+{
+	memcpy(code + size, &value, sizeof(value));
+	size += sizeof(value);
+}
+
+void X64Emitter::emit_u64(u64 value)
+{
+	memcpy(code + size, &value, sizeof(value));
+	size += sizeof(value);
+}
+
+void X64Emitter::rex(bool wide, u8 reg, u8 base)
+{
+	u8 prefix = 0x40 | (wide << 3) | (((reg >> 3) & 1) << 2) | ((base >> 3) & 1);
+	if (prefix != 0x40)
+		emit_u8(prefix);
+}
+
+void X64Emitter::modrm_reg(u8 reg, u8 rm)
+{
+	emit_u8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X64Emitter::modrm_mem(u8 reg, X64Reg base, s32 disp)
+{
+	emit_u8(0x80 | ((reg & 7) << 3) | (base & 7));
+	//rsp and r12 as a base need a sib byte
+	if ((base & 7) == RSP)
+		emit_u8(0x24);
+	emit_u32((u32)disp);
+}
+
+void X64Emitter::modrm_indexed(u8 reg, X64Reg base, X64Reg index)
+{
+	//[base + index] without displacement, rbp and r13 can not be the base here
+	emit_u8(((reg & 7) << 3) | 0x04);
+	emit_u8(((index & 7) << 3) | (base & 7));
+}
+
+void X64Emitter::mov_r32_m32(X64Reg reg, X64Reg base, s32 disp)
+{
+	rex(false, reg, base);
+	emit_u8(0x8B);
+	modrm_mem(reg, base, disp);
+}
+
+void X64Emitter::mov_m32_r32(X64Reg base, s32 disp, X64Reg reg)
+{
+	rex(false, reg, base);
+	emit_u8(0x89);
+	modrm_mem(reg, base, disp);
+}
+
+void X64Emitter::mov_m32_imm32(X64Reg base, s32 disp, u32 imm)
+{
+	rex(false, 0, base);
+	emit_u8(0xC7);
+	modrm_mem(0, base, disp);
+	emit_u32(imm);
+}
+
+void X64Emitter::mov_m8_imm8(X64Reg base, s32 disp, u8 imm)
+{
+	rex(false, 0, base);
+	emit_u8(0xC6);
+	modrm_mem(0, base, disp);
+	emit_u8(imm);
+}
+
+void X64Emitter::mov_r32_imm32(X64Reg reg, u32 imm)
+{
+	rex(false, 0, reg);
+	emit_u8(0xB8 + (reg & 7));
+	emit_u32(imm);
+}
+
+void X64Emitter::mov_r64_imm64(X64Reg reg, u64 imm)
+{
+	rex(true, 0, reg);
+	emit_u8(0xB8 + (reg & 7));
+	emit_u64(imm);
+}
+
+void X64Emitter::mov_r64_r64(X64Reg dst, X64Reg src)
+{
+	rex(true, src, dst);
+	emit_u8(0x89);
+	modrm_reg(src, dst);
+}
+
+void X64Emitter::mov_r32_r32(X64Reg dst, X64Reg src)
+{
+	rex(false, src, dst);
+	emit_u8(0x89);
+	modrm_reg(src, dst);
+}
+
+void X64Emitter::load_indexed(X64Width width, bool sign_extend, X64Reg reg, X64Reg base, X64Reg index)
+{
+	u8 prefix = 0x40 | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+	if (prefix != 0x40)
+		emit_u8(prefix);
+
+	switch (width) {
+		case WIDTH_8: emit_u8(0x0F); emit_u8(sign_extend ? 0xBE : 0xB6); break;
+		case WIDTH_16: emit_u8(0x0F); emit_u8(sign_extend ? 0xBF : 0xB7); break;
+		case WIDTH_32: emit_u8(0x8B); break;
+	}
+	modrm_indexed(reg, base, index);
+}
+
+void X64Emitter::store_indexed(X64Width width, X64Reg base, X64Reg index, X64Reg reg)
+{
+	if (width == WIDTH_16)
+		emit_u8(0x66);
+
+	u8 prefix = 0x40 | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+	//byte stores of spl/bpl/sil/dil need a rex prefix as well
+	if (prefix != 0x40 || (width == WIDTH_8 && reg >= RSP))
+		emit_u8(prefix);
+
+	emit_u8(width == WIDTH_8 ? 0x88 : 0x89);
+	modrm_indexed(reg, base, index);
+}
+
+void X64Emitter::alu_r32_imm32(X64AluOp op, X64Reg reg, u32 imm)
+{
+	rex(false, 0, reg);
+	emit_u8(0x81);
+	modrm_reg(op, reg);
+	emit_u32(imm);
+}
+
+void X64Emitter::alu_m32_imm32(X64AluOp op, X64Reg base, s32 disp, u32 imm)
+{
+	rex(false, 0, base);
+	emit_u8(0x81);
+	modrm_mem(op, base, disp);
+	emit_u32(imm);
+}
+
+void X64Emitter::cmp_r32_m32(X64Reg reg, X64Reg base, s32 disp)
+{
+	rex(false, reg, base);
+	emit_u8(0x3B);
+	modrm_mem(reg, base, disp);
+}
+
+void X64Emitter::test_r32_r32(X64Reg a, X64Reg b)
+{
+	rex(false, b, a);
+	emit_u8(0x85);
+	modrm_reg(b, a);
+}
+
+void X64Emitter::test_r32_imm32(X64Reg reg, u32 imm)
+{
+	rex(false, 0, reg);
+	emit_u8(0xF7);
+	modrm_reg(0, reg);
+	emit_u32(imm);
+}
+
+void X64Emitter::shr_r32_imm8(X64Reg reg, u8 imm)
+{
+	rex(false, 0, reg);
+	emit_u8(0xC1);
+	modrm_reg(5, reg);
+	emit_u8(imm);
+}
+
+void X64Emitter::bt_m32_r32(X64Reg base, X64Reg bit)
+{
+	rex(false, bit, base);
+	emit_u8(0x0F);
+	emit_u8(0xA3);
+	modrm_mem(bit, base, 0);
+}
+
+void X64Emitter::setcc_r8(X64Condition condition, X64Reg reg)
+{
+	//a rex prefix selects spl/bpl/sil/dil instead of ah/ch/dh/bh
+	if (reg >= RSP)
+		emit_u8(0x40 | ((reg >> 3) & 1));
+	emit_u8(0x0F);
+	emit_u8(0x90 + condition);
+	modrm_reg(0, reg);
+}
+
+void X64Emitter::movzx_r32_r8(X64Reg dst, X64Reg src)
+{
+	if (src >= RSP || dst >= R8)
+		emit_u8(0x40 | (((dst >> 3) & 1) << 2) | ((src >> 3) & 1));
+	emit_u8(0x0F);
+	emit_u8(0xB6);
+	modrm_reg(dst, src);
+}
+
+void X64Emitter::cmovcc_r32_r32(X64Condition condition, X64Reg dst, X64Reg src)
+{
+	rex(false, dst, src);
+	emit_u8(0x0F);
+	emit_u8(0x40 + condition);
+	modrm_reg(dst, src);
+}
+
+void X64Emitter::push_r64(X64Reg reg)
+{
+	rex(false, 0, reg);
+	emit_u8(0x50 + (reg & 7));
+}
+
+void X64Emitter::pop_r64(X64Reg reg)
+{
+	rex(false, 0, reg);
+	emit_u8(0x58 + (reg & 7));
+}
+
+void X64Emitter::sub_rsp_imm8(u8 imm)
+{
+	emit_u8(0x48);
+	emit_u8(0x83);
+	emit_u8(0xEC);
+	emit_u8(imm);
+}
+
+void X64Emitter::add_rsp_imm8(u8 imm)
+{
+	emit_u8(0x48);
+	emit_u8(0x83);
+	emit_u8(0xC4);
+	emit_u8(imm);
+}
+
+void X64Emitter::call_r64(X64Reg reg)
+{
+	rex(false, 0, reg);
+	emit_u8(0xFF);
+	modrm_reg(2, reg);
+}
+
+void X64Emitter::jmp_r64(X64Reg reg)
+{
+	rex(false, 0, reg);
+	emit_u8(0xFF);
+	modrm_reg(4, reg);
+}
+
+u8* X64Emitter::jmp_rel32(const u8* target)
+{
+	emit_u8(0xE9);
+	u8* displacement = current();
+	emit_u32((u32)(target - (displacement + 4)));
+
+	return displacement;
+}
+
+u8* X64Emitter::jcc_rel32(X64Condition condition, const u8* target)
+{
+	emit_u8(0x0F);
+	emit_u8(0x80 + condition);
+	u8* displacement = current();
+	emit_u32((u32)(target - (displacement + 4)));
+
+	return displacement;
+}
+
+void X64Emitter::ret()
+{
+	emit_u8(0xC3);
+}
+
+void X64Emitter::nop(u32 count)
+{
+	for (u32 i = 0; i < count; i++)
+		emit_u8(0x90);
+}
+
+void X64Emitter::patch_rel32(u8* site, const u8* target)
+{
+	u32 displacement = (u32)(target - (site + 4));
+	memcpy(site, &displacement, sizeof(displacement));
+}
+
+void X64Emitter::patch_jmp(u8* site, const u8* target)
+{
+	site[0] = 0xE9;
+	patch_rel32(site + 1, target);
+}
\ No newline at end of file
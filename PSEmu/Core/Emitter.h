@@ -0,0 +1,100 @@
+#pragma once
+#include "Common.h"
+
+enum X64Reg : u8 {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum X64Condition : u8 {
+	CC_O = 0x0,
+	CC_B = 0x2,
+	CC_AE = 0x3,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_L = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G = 0xF
+};
+
+//widths for [base + index] memory accesses
+enum X64Width : u8 {
+	WIDTH_8,
+	WIDTH_16,
+	WIDTH_32
+};
+
+//group 1 opcode extensions for the 0x81 alu forms
+enum X64AluOp : u8 {
+	ALU_ADD = 0,
+	ALU_OR = 1,
+	ALU_AND = 4,
+	ALU_SUB = 5,
+	ALU_XOR = 6,
+	ALU_CMP = 7
+};
+
+//Minimal x86-64 code emitter writing into one executable buffer.
+//Memory operands are [base + disp32] or [base + index] for guest memory
+struct X64Emitter {
+	X64Emitter();
+	~X64Emitter();
+
+	bool allocate(u32 capacity);
+	void reset();
+	u8* current();
+	u32 free_space();
+
+	void mov_r32_m32(X64Reg reg, X64Reg base, s32 disp);
+	void mov_m32_r32(X64Reg base, s32 disp, X64Reg reg);
+	void mov_m32_imm32(X64Reg base, s32 disp, u32 imm);
+	void mov_m8_imm8(X64Reg base, s32 disp, u8 imm);
+	void mov_r32_imm32(X64Reg reg, u32 imm);
+	void mov_r64_imm64(X64Reg reg, u64 imm);
+	void mov_r64_r64(X64Reg dst, X64Reg src);
+	void mov_r32_r32(X64Reg dst, X64Reg src);
+
+	//loads zero or sign extend to 32 bits, stores take the low bits of reg
+	void load_indexed(X64Width width, bool sign_extend, X64Reg reg, X64Reg base, X64Reg index);
+	void store_indexed(X64Width width, X64Reg base, X64Reg index, X64Reg reg);
+
+	void alu_r32_imm32(X64AluOp op, X64Reg reg, u32 imm);
+	void alu_m32_imm32(X64AluOp op, X64Reg base, s32 disp, u32 imm);
+	void cmp_r32_m32(X64Reg reg, X64Reg base, s32 disp);
+	void test_r32_r32(X64Reg a, X64Reg b);
+	void test_r32_imm32(X64Reg reg, u32 imm);
+	void shr_r32_imm8(X64Reg reg, u8 imm);
+	void bt_m32_r32(X64Reg base, X64Reg bit);
+	void setcc_r8(X64Condition condition, X64Reg reg);
+	void movzx_r32_r8(X64Reg dst, X64Reg src);
+	void cmovcc_r32_r32(X64Condition condition, X64Reg dst, X64Reg src);
+
+	void push_r64(X64Reg reg);
+	void pop_r64(X64Reg reg);
+	void sub_rsp_imm8(u8 imm);
+	void add_rsp_imm8(u8 imm);
+
+	void call_r64(X64Reg reg);
+	void jmp_r64(X64Reg reg);
+	u8* jmp_rel32(const u8* target); //returns the rel32 field for patching
+	u8* jcc_rel32(X64Condition condition, const u8* target);
+	void ret();
+	void nop(u32 count);
+
+	static void patch_rel32(u8* site, const u8* target);
+	static void patch_jmp(u8* site, const u8* target); //overwrites 5 bytes at site
+
+private:
+	void emit_u8(u8 value);
+	void emit_u32(u32 value);
+	void emit_u64(u64 value);
+	void rex(bool wide, u8 reg, u8 base);
+	void modrm_reg(u8 reg, u8 rm);
+	void modrm_mem(u8 reg, X64Reg base, s32 disp);
+	void modrm_indexed(u8 reg, X64Reg base, X64Reg index);
+
+	u8* code;
+	u32 capacity;
+	u32 size;
+};
\ No newline at end of file
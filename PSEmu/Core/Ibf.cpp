@@ -1,26 +1,10 @@
 #include "Cpu.h"
 
-u16 InstructionBitField::immediate_16()
-{
-	return opcode & 0xFFFF;
-}
-
-u32 InstructionBitField::immediate_26()
-{
-	return opcode & 0x7FFFFFF;
-}
-
-u8 InstructionBitField::rs()
-{
-	return (opcode >> 21) & 0x1F;
-}
-
-u8 InstructionBitField::rt()
-{
-	return (opcode >> 16) & 0x1F;
-}
-
-u8 InstructionBitField::rd()
-{
-	return (opcode >> 11) & 0x3F;
-}
+InstructionBitField::InstructionBitField(u32 opcode)
+	:opcode(opcode), fused_cycles(0)
+{
+	immediate_sign_extended = (u32)(s32)(s16)(opcode & 0xFFFF);
+	register_s = (opcode >> 21) & 0x1F;
+	register_t = (opcode >> 16) & 0x1F;
+	register_d = (opcode >> 11) & 0x1F;
+}
\ No newline at end of file
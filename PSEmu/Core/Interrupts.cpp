@@ -0,0 +1,57 @@
+#include "Interrupts.h"
+
+#define INTERRUPT_BITS ((1 << INTERRUPT_SOURCE_COUNT) - 1)
+
+void InterruptController::reset()
+{
+	status = 0;
+	mask = 0;
+	update_line();
+}
+
+void InterruptController::set_line_handler(InterruptLineHandler handler, void* context)
+{
+	line_handler = handler;
+	line_context = context;
+	if (line_handler != nullptr)
+		line_handler(line_context, line);
+}
+
+void InterruptController::request(InterruptSource source)
+{
+	status |= 1 << source;
+	update_line();
+}
+
+u32 InterruptController::read(void* device, u32 address)
+{
+	InterruptController* controller = (InterruptController*)device;
+	switch (address) {
+		case INTERRUPT_STATUS: return controller->status;
+		case INTERRUPT_MASK: return controller->mask;
+		default: return 0; //upper halves
+	}
+}
+
+void InterruptController::write(void* device, u32 address, u32 value)
+{
+	InterruptController* controller = (InterruptController*)device;
+	switch (address) {
+		//zero bits acknowledge, ones keep the request
+		case INTERRUPT_STATUS: controller->status &= value; break;
+		case INTERRUPT_MASK: controller->mask = value & INTERRUPT_BITS; break;
+		default: return;
+	}
+	controller->update_line();
+}
+
+void InterruptController::update_line()
+{
+	bool asserted = (status & mask) != 0;
+	if (asserted == line)
+		return;
+
+	line = asserted;
+	if (line_handler != nullptr)
+		line_handler(line_context, line);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include "Common.h"
+
+#define INTERRUPT_STATUS 0x1F801070 //I_STAT
+#define INTERRUPT_MASK 0x1F801074 //I_MASK
+
+//bit in I_STAT and I_MASK
+enum InterruptSource : u8 {
+	IRQ_VBLANK,
+	IRQ_GPU,
+	IRQ_CDROM,
+	IRQ_DMA,
+	IRQ_TIMER_0,
+	IRQ_TIMER_1,
+	IRQ_TIMER_2,
+	IRQ_CONTROLLER,
+	IRQ_SIO,
+	IRQ_SPU,
+	IRQ_LIGHTPEN,
+	INTERRUPT_SOURCE_COUNT
+};
+
+//called only when (I_STAT & I_MASK) != 0 changes, the cpu sees it as cause.IP2
+typedef void (*InterruptLineHandler)(void* context, bool asserted);
+
+//I_STAT and I_MASK. Devices raise their bit in I_STAT, software acknowledges
+//by writing zeroes to it. The output line is recomputed on every change so
+//nothing has to poll the registers
+struct InterruptController {
+	void reset();
+	void set_line_handler(InterruptLineHandler handler, void* context);
+	void request(InterruptSource source);
+
+	static u32 read(void* device, u32 address);
+	static void write(void* device, u32 address, u32 value);
+
+private:
+	void update_line();
+
+	u32 status = 0;
+	u32 mask = 0;
+	bool line = false;
+
+	InterruptLineHandler line_handler = nullptr;
+	void* line_context = nullptr;
+};
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "MemoryTrace.h"
+#include <algorithm>
+#include <chrono>
+
+MemoryTracer::MemoryTracer()
+	:pc(&no_pc), cycle(&MemoryTracer::no_cycle), generation(&no_generation), running(false), dropped(0), head(0), tail(0)
+{
+
+}
+
+MemoryTracer::~MemoryTracer()
+{
+	stop();
+}
+
+bool MemoryTracer::start(const std::string& path, u32 capacity)
+{
+	if (file != nullptr)
+		stop();
+
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		printf("!!Trace capacity %u is not a power of two!!\n", capacity);
+		return false;
+	}
+
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		printf("!!Failed to open trace file %s!!\n", path.c_str());
+		return false;
+	}
+
+	const u32 header[] = { TRACE_FILE_MAGIC, TRACE_FILE_VERSION, sizeof(TraceRecord) };
+	fwrite(header, sizeof(header), 1, file);
+
+	records.reset(new TraceRecord[capacity]);
+	this->capacity = capacity;
+	head.store(0);
+	tail.store(0);
+	dropped.store(0);
+
+	running.store(true);
+	writer = std::thread(&MemoryTracer::drain, this);
+	return true;
+}
+
+void MemoryTracer::stop()
+{
+	if (file == nullptr)
+		return;
+
+	running.store(false);
+	writer.join();
+	write_pending();
+
+	fclose(file);
+	file = nullptr;
+	if (dropped.load() != 0)
+		printf("Trace dropped %llu records\n", (unsigned long long)dropped.load());
+}
+
+bool MemoryTracer::add_range(u32 start, u32 length)
+{
+	if (range_count == TRACE_MAX_RANGES) {
+		printf("!!Only %d trace ranges are supported!!\n", TRACE_MAX_RANGES);
+		return false;
+	}
+
+	ranges[range_count++] = { start & 0x1FFFFFFF, length };
+	(*generation)++;
+	return true;
+}
+
+void MemoryTracer::clear_ranges()
+{
+	range_count = 0;
+	(*generation)++;
+}
+
+bool MemoryTracer::overlaps(u32 start, u32 length)
+{
+	if (range_count == 0)
+		return true;
+	for (u32 i = 0; i < range_count; i++) {
+		if (ranges[i].start < ((u64)start + length) && start < ((u64)ranges[i].start + ranges[i].length))
+			return true;
+	}
+	return false;
+}
+
+void MemoryTracer::set_source(const u32* pc, u64 (*cycle)(void* context), void* context)
+{
+	this->pc = pc;
+	this->cycle = cycle;
+	cycle_context = context;
+}
+
+void MemoryTracer::set_generation(u32* generation)
+{
+	this->generation = generation != nullptr ? generation : &no_generation;
+}
+
+void MemoryTracer::drain()
+{
+	//polling keeps the emulator side free of any wakeup call
+	while (running.load(std::memory_order_relaxed)) {
+		if (write_pending() == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+u32 MemoryTracer::write_pending()
+{
+	u32 position = tail.load(std::memory_order_relaxed);
+	u32 count = head.load(std::memory_order_acquire) - position;
+	if (count == 0)
+		return 0;
+
+	//at most two runs, up to the end of the buffer and from its start
+	u32 start = position & (capacity - 1);
+	u32 first = std::min(count, capacity - start);
+	fwrite(&records[start], sizeof(TraceRecord), first, file);
+	if (count > first)
+		fwrite(&records[0], sizeof(TraceRecord), count - first, file);
+
+	tail.store(position + count, std::memory_order_release);
+	return count;
+}
\ No newline at end of file
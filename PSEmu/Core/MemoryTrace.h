@@ -0,0 +1,114 @@
+#pragma once
+#include "Common.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#define TRACE_DEFAULT_CAPACITY (1 << 16) //records, a power of two
+#define TRACE_MAX_RANGES 8
+#define TRACE_FILE_MAGIC 0x52545350 //"PSTR"
+#define TRACE_FILE_VERSION 1
+
+#define TRACE_FLAG_WRITE 0x1
+
+//one bus access as stored in the trace file, after a header of
+//magic, version and record size (three u32)
+#pragma pack(push, 1)
+struct TraceRecord {
+	u64 cycle; //cpu cycle of the access
+	u32 pc; //of the instruction doing the access
+	u32 address;
+	u32 value;
+	u8 width; //in bytes
+	u8 flags;
+	u16 reserved;
+};
+#pragma pack(pop)
+
+//Records bus accesses into a single producer single consumer ring buffer
+//that a background thread drains to a file. The emulator never waits on
+//the writer, records that do not fit are counted as dropped instead.
+//Ranges are physical addresses, with none set every access is recorded
+struct MemoryTracer {
+	MemoryTracer();
+	~MemoryTracer();
+
+	bool start(const std::string& path, u32 capacity = TRACE_DEFAULT_CAPACITY);
+	void stop(); //drains what is left and closes the file
+
+	//ranges are checked on the emulator thread before the record is built,
+	//changing them bumps the generation so recompiled code is rebuilt
+	bool add_range(u32 start, u32 length);
+	void clear_ranges();
+	bool overlaps(u32 start, u32 length); //any access in the physical range may be recorded
+
+	//where the pc of each record is read from and what gives its cycle
+	void set_source(const u32* pc, u64 (*cycle)(void* context), void* context);
+	void set_generation(u32* generation); //observer generation of the bus traced, nullptr when detached
+
+	void record(u32 address, u32 value, u8 width, bool write)
+	{
+		if (!traced(address & 0x1FFFFFFF))
+			return;
+
+		u32 position = head.load(std::memory_order_relaxed);
+		if ((position - tail.load(std::memory_order_acquire)) == capacity) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		TraceRecord& entry = records[position & (capacity - 1)];
+		entry.cycle = cycle(cycle_context);
+		entry.pc = *pc;
+		entry.address = address;
+		entry.value = value;
+		entry.width = width;
+		entry.flags = write ? TRACE_FLAG_WRITE : 0;
+		entry.reserved = 0;
+		head.store(position + 1, std::memory_order_release);
+	}
+
+	u64 dropped_records() { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	bool traced(u32 physical)
+	{
+		if (range_count == 0)
+			return true;
+		for (u32 i = 0; i < range_count; i++) {
+			if ((physical - ranges[i].start) < ranges[i].length)
+				return true;
+		}
+		return false;
+	}
+
+	void drain();
+	u32 write_pending(); //returns how many records were written
+
+	struct Range {
+		u32 start;
+		u32 length;
+	};
+	std::array<Range, TRACE_MAX_RANGES> ranges;
+	u32 range_count = 0;
+	u32* generation;
+	u32 no_generation = 0; //bumped while no bus is attached
+
+	const u32* pc;
+	u64 (*cycle)(void* context);
+	void* cycle_context = nullptr;
+	u32 no_pc = 0; //sources until set_source is called
+	static u64 no_cycle(void* context) { return 0; }
+
+	std::unique_ptr<TraceRecord[]> records;
+	u32 capacity = 0;
+	FILE* file = nullptr;
+	std::thread writer;
+	std::atomic<bool> running;
+	std::atomic<u64> dropped;
+
+	//written by the emulator and the writer thread, kept on separate cache lines
+	alignas(64) std::atomic<u32> head;
+	alignas(64) std::atomic<u32> tail;
+};
\ No newline at end of file
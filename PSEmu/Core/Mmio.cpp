@@ -0,0 +1,95 @@
+#include "Mmio.h"
+#include <algorithm>
+
+MmioTable::MmioTable()
+{
+	handlers[0] = MmioHandler{ &MmioTable::latch_read_u8, &MmioTable::latch_write_u8, this, true };
+	handlers[1] = MmioHandler{ &MmioTable::latch_read_u16, &MmioTable::latch_write_u16, this, true };
+	handlers[2] = MmioHandler{ &MmioTable::latch_read_u32, &MmioTable::latch_write_u32, this, true };
+	handler_count = 3;
+
+	for (u32 width = 0; width < slots.size(); width++)
+		slots[width].fill((u8)width);
+}
+
+void MmioTable::set_latch(u8* latch)
+{
+	this->latch = latch;
+}
+
+bool MmioTable::register_handler(u32 address, u32 length, u8 widths,
+	MmioReadHandler read, MmioWriteHandler write, void* device)
+{
+	u32 offset = (address & 0x1FFFFFFF) - 0x1F801000;
+	if (offset >= IO_PORTS_SIZE || length > (IO_PORTS_SIZE - offset)) {
+		printf("!!Mmio handler at 0x%08X is outside the io ports!!\n", address);
+		return false;
+	}
+	if (handler_count == MMIO_MAX_HANDLERS) {
+		printf("!!Too many mmio handlers!!\n");
+		return false;
+	}
+
+	u8 index = (u8)handler_count++;
+	handlers[index] = MmioHandler{ read, write, device, (widths & MMIO_POLLABLE) != 0 };
+	for (u32 width = 0; width < slots.size(); width++) {
+		if ((widths & (1 << width)) != 0)
+			std::fill(&slots[width][offset], &slots[width][offset] + length, index);
+	}
+	return true;
+}
+
+u32 MmioTable::read(u32 address, u32 size)
+{
+	u32 offset = (address & 0x1FFFFFFF) - 0x1F801000;
+	MmioHandler& handler = handlers[slots[width_index(size)][offset]];
+	return handler.read(handler.device, address & 0x1FFFFFFF);
+}
+
+void MmioTable::write(u32 address, u32 value, u32 size)
+{
+	u32 offset = (address & 0x1FFFFFFF) - 0x1F801000;
+	MmioHandler& handler = handlers[slots[width_index(size)][offset]];
+	handler.write(handler.device, address & 0x1FFFFFFF, value);
+}
+
+bool MmioTable::pollable(u32 address, u32 size)
+{
+	u32 offset = (address & 0x1FFFFFFF) - 0x1F801000;
+	return handlers[slots[width_index(size)][offset]].pollable;
+}
+
+u32 MmioTable::latch_read_u8(void* device, u32 address)
+{
+	return ((MmioTable*)device)->latch[address - 0x1F801000];
+}
+
+u32 MmioTable::latch_read_u16(void* device, u32 address)
+{
+	u16 value;
+	memcpy(&value, &((MmioTable*)device)->latch[address - 0x1F801000], sizeof(value));
+	return value;
+}
+
+u32 MmioTable::latch_read_u32(void* device, u32 address)
+{
+	u32 value;
+	memcpy(&value, &((MmioTable*)device)->latch[address - 0x1F801000], sizeof(value));
+	return value;
+}
+
+void MmioTable::latch_write_u8(void* device, u32 address, u32 value)
+{
+	((MmioTable*)device)->latch[address - 0x1F801000] = (u8)value;
+}
+
+void MmioTable::latch_write_u16(void* device, u32 address, u32 value)
+{
+	u16 halfword = (u16)value;
+	memcpy(&((MmioTable*)device)->latch[address - 0x1F801000], &halfword, sizeof(halfword));
+}
+
+void MmioTable::latch_write_u32(void* device, u32 address, u32 value)
+{
+	memcpy(&((MmioTable*)device)->latch[address - 0x1F801000], &value, sizeof(value));
+}
\ No newline at end of file
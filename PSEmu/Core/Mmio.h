@@ -0,0 +1,58 @@
+#pragma once
+#include "Common.h"
+#include <array>
+
+#define IO_PORTS_SIZE 0x2000
+
+//access widths a handler is registered for
+#define MMIO_WIDTH_8 0x1
+#define MMIO_WIDTH_16 0x2
+#define MMIO_WIDTH_32 0x4
+#define MMIO_WIDTH_ALL (MMIO_WIDTH_8 | MMIO_WIDTH_16 | MMIO_WIDTH_32)
+//reads have no side effects, a loop polling the registers may be skipped
+#define MMIO_POLLABLE 0x8
+
+#define MMIO_MAX_HANDLERS 256
+
+//handlers get the physical address, one handler can serve a whole device
+typedef u32 (*MmioReadHandler)(void* device, u32 address);
+typedef void (*MmioWriteHandler)(void* device, u32 address, u32 value);
+
+struct MmioHandler {
+	MmioReadHandler read;
+	MmioWriteHandler write;
+	void* device;
+	bool pollable;
+};
+
+//Register level dispatch for the io port region. Every byte offset has a
+//handler index per access width, so an access is two table lookups and an
+//indirect call. Registers nobody claimed read back what was last written
+struct MmioTable {
+	MmioTable();
+
+	void set_latch(u8* latch); //backing memory for unclaimed registers
+	bool register_handler(u32 address, u32 length, u8 widths,
+		MmioReadHandler read, MmioWriteHandler write, void* device);
+
+	u32 read(u32 address, u32 size);
+	void write(u32 address, u32 value, u32 size);
+	bool pollable(u32 address, u32 size);
+
+private:
+	static u32 width_index(u32 size) { return size >> 1; } //1, 2, 4 bytes to 0, 1, 2
+
+	static u32 latch_read_u8(void* device, u32 address);
+	static u32 latch_read_u16(void* device, u32 address);
+	static u32 latch_read_u32(void* device, u32 address);
+	static void latch_write_u8(void* device, u32 address, u32 value);
+	static void latch_write_u16(void* device, u32 address, u32 value);
+	static void latch_write_u32(void* device, u32 address, u32 value);
+
+	u8* latch = nullptr;
+
+	//handler index by width and offset, the first three handlers are the latch
+	std::array<std::array<u8, IO_PORTS_SIZE>, 3> slots;
+	std::array<MmioHandler, MMIO_MAX_HANDLERS> handlers;
+	u32 handler_count;
+};
\ No newline at end of file
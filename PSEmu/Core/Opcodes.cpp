@@ -1,29 +1,259 @@
 #include "Cpu.h"
 
-void Cpu::map_opcodes()
+const std::array<Instruction, 0x40> Cpu::primary_lut = { {
+	/*0x00*/ Instruction{ &Cpu::special, 1 },
+	/*0x01*/ Instruction{ &Cpu::bcond, 1 },
+	/*0x02*/ Instruction{ &Cpu::j, 1 },
+	/*0x03*/ Instruction{ &Cpu::jal, 1 },
+	/*0x04*/ Instruction{ &Cpu::beq, 1 },
+	/*0x05*/ Instruction{ &Cpu::bne, 1 },
+	/*0x06*/ Instruction{ &Cpu::blez, 1 },
+	/*0x07*/ Instruction{ &Cpu::bgtz, 1 },
+	/*0x08*/ Instruction{ &Cpu::addi, 1 },
+	/*0x09*/ Instruction{ &Cpu::addiu, 1 },
+	/*0x0A*/ Instruction{ &Cpu::slti, 1 },
+	/*0x0B*/ Instruction{ &Cpu::sltiu, 1 },
+	/*0x0C*/ Instruction{ &Cpu::andi, 1 },
+	/*0x0D*/ Instruction{ &Cpu::ori, 1 },
+	/*0x0E*/ Instruction{ &Cpu::xori, 1 },
+	/*0x0F*/ Instruction{ &Cpu::lui, 1 },
+	/*0x10*/ Instruction{ &Cpu::cop0, 1 },
+	/*0x11*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x12*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x13*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x14*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x15*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x16*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x17*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x18*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x19*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1A*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1B*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1F*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x20*/ Instruction{ &Cpu::lb<BUS_PLAIN>, 1 },
+	/*0x21*/ Instruction{ &Cpu::lh<BUS_PLAIN>, 1 },
+	/*0x22*/ Instruction{ &Cpu::lwl<BUS_PLAIN>, 1 },
+	/*0x23*/ Instruction{ &Cpu::lw<BUS_PLAIN>, 1 },
+	/*0x24*/ Instruction{ &Cpu::lbu<BUS_PLAIN>, 1 },
+	/*0x25*/ Instruction{ &Cpu::lhu<BUS_PLAIN>, 1 },
+	/*0x26*/ Instruction{ &Cpu::lwr<BUS_PLAIN>, 1 },
+	/*0x27*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x28*/ Instruction{ &Cpu::sb<BUS_PLAIN>, 1 },
+	/*0x29*/ Instruction{ &Cpu::sh<BUS_PLAIN>, 1 },
+	/*0x2A*/ Instruction{ &Cpu::swl<BUS_PLAIN>, 1 },
+	/*0x2B*/ Instruction{ &Cpu::sw<BUS_PLAIN>, 1 },
+	/*0x2C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2E*/ Instruction{ &Cpu::swr<BUS_PLAIN>, 1 },
+	/*0x2F*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x30*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x31*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x32*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x33*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x34*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x35*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x36*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x37*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x38*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x39*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3A*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3B*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3F*/ Instruction{ &Cpu::undefined_instruction, 1 }
+} };
+
+//secondary field
+const std::array<Instruction, 0x40> Cpu::secondary_lut = { {
+	/*0x00*/ Instruction{ &Cpu::sll, 1 },
+	/*0x01*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x02*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x03*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x04*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x05*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x06*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x07*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x08*/ Instruction{ &Cpu::jr, 1 },
+	/*0x09*/ Instruction{ &Cpu::jalr, 1 },
+	/*0x0A*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x0B*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x0C*/ Instruction{ &Cpu::syscall, 1 },
+	/*0x0D*/ Instruction{ &Cpu::breakpoint, 1 },
+	/*0x0E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x0F*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x10*/ Instruction{ &Cpu::mfhi, 1 },
+	/*0x11*/ Instruction{ &Cpu::mthi, 1 },
+	/*0x12*/ Instruction{ &Cpu::mflo, 1 },
+	/*0x13*/ Instruction{ &Cpu::mtlo, 1 },
+	/*0x14*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x15*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x16*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x17*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x18*/ Instruction{ &Cpu::mult, 1 },
+	/*0x19*/ Instruction{ &Cpu::multu, 1 },
+	/*0x1A*/ Instruction{ &Cpu::div, 1 },
+	/*0x1B*/ Instruction{ &Cpu::divu, 1 },
+	/*0x1C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x1F*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x20*/ Instruction{ &Cpu::add, 1 },
+	/*0x21*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x22*/ Instruction{ &Cpu::sub, 1 },
+	/*0x23*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x24*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x25*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x26*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x27*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x28*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x29*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2A*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2B*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x2F*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x30*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x31*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x32*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x33*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x34*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x35*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x36*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x37*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x38*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x39*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3A*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3B*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3C*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3D*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3E*/ Instruction{ &Cpu::undefined_instruction, 1 },
+	/*0x3F*/ Instruction{ &Cpu::undefined_instruction, 1 }
+} };
+
+//primary_lut 0x20-0x2F for every bus policy
+#define MEMORY_LUT(policy) { { \
+	Instruction{ &Cpu::lb<policy>, 1 }, \
+	Instruction{ &Cpu::lh<policy>, 1 }, \
+	Instruction{ &Cpu::lwl<policy>, 1 }, \
+	Instruction{ &Cpu::lw<policy>, 1 }, \
+	Instruction{ &Cpu::lbu<policy>, 1 }, \
+	Instruction{ &Cpu::lhu<policy>, 1 }, \
+	Instruction{ &Cpu::lwr<policy>, 1 }, \
+	Instruction{ &Cpu::undefined_instruction, 1 }, \
+	Instruction{ &Cpu::sb<policy>, 1 }, \
+	Instruction{ &Cpu::sh<policy>, 1 }, \
+	Instruction{ &Cpu::swl<policy>, 1 }, \
+	Instruction{ &Cpu::sw<policy>, 1 }, \
+	Instruction{ &Cpu::undefined_instruction, 1 }, \
+	Instruction{ &Cpu::undefined_instruction, 1 }, \
+	Instruction{ &Cpu::swr<policy>, 1 }, \
+	Instruction{ &Cpu::undefined_instruction, 1 } \
+} }
+
+const std::array<std::array<Instruction, 0x10>, BUS_POLICY_COUNT> Cpu::memory_luts = { {
+	MEMORY_LUT(BUS_PLAIN),
+	MEMORY_LUT(BUS_WATCHPOINTS),
+	MEMORY_LUT(BUS_TRACING),
+	MEMORY_LUT(BUS_WATCHPOINTS | BUS_TRACING)
+} };
+#undef MEMORY_LUT
+
+//lw of the lui_lw pair per bus policy
+const std::array<void (Cpu::*)(InstructionBitField&), BUS_POLICY_COUNT> Cpu::fused_loads = { {
+	&Cpu::lui_lw<BUS_PLAIN>,
+	&Cpu::lui_lw<BUS_WATCHPOINTS>,
+	&Cpu::lui_lw<BUS_TRACING>,
+	&Cpu::lui_lw<BUS_WATCHPOINTS | BUS_TRACING>
+} };
+
+//sll to r0 changes nothing, whatever the shift
+static const Instruction nop_instruction = Instruction{ &Cpu::nop, 1 };
+
+DecodedInstruction Cpu::decode(u32 opcode)
 {
-	primary_lut[0x00] = Instruction{ b(&Cpu::special), 1 };
-	primary_lut[0x01] = Instruction{ b(&Cpu::bcond), 1 };
-	primary_lut[0x02] = Instruction{ b(&Cpu::j), 1 };
-	primary_lut[0x03] = Instruction{ b(&Cpu::jal), 1 };
-	primary_lut[0x04] = Instruction{ b(&Cpu::beq), 1 };
-	primary_lut[0x05] = Instruction{ b(&Cpu::bne), 1 };
-	primary_lut[0x06] = Instruction{ b(&Cpu::blez), 1 };
-	primary_lut[0x07] = Instruction{ b(&Cpu::bgtz), 1 };
-
-	primary_lut[0x08] = Instruction{ b(&Cpu::addi), 1 };
-	primary_lut[0x09] = Instruction{ b(&Cpu::addiu), 1 };
-	primary_lut[0x0A] = Instruction{ b(&Cpu::slti), 1 };
-	primary_lut[0x0B] = Instruction{ b(&Cpu::sltiu), 1 };
-	primary_lut[0x0C] = Instruction{ b(&Cpu::andi), 1 };
-	primary_lut[0x0D] = Instruction{ b(&Cpu::ori), 1 };
-	primary_lut[0x0E] = Instruction{ b(&Cpu::xori), 1 };
-	primary_lut[0x0F] = Instruction{ b(&Cpu::lui), 1 };
-	for (s32 i = 0x20; i < 0x27; i++) primary_lut[i] = Instruction{ b(&Cpu::load), 1 };
-	primary_lut[0x27] = Instruction{ b(&Cpu::undefined_instruction), 1 };
-	for (s32 i = 0x28; i < 0x2C; i++) primary_lut[i] = Instruction{ b(&Cpu::store), 1 };
-	
-	//secondary field
-	secondary_lut[0x08] = Instruction{ b(&Cpu::jr), 1 };
-	secondary_lut[0x09] = Instruction{ b(&Cpu::jalr), 1 };
+	u8 primary_opcode = (opcode >> 26) & 0x3F;
+	const Instruction* instruction = &primary_lut[primary_opcode];
+	//resolve special through the secondary field up front
+	if (primary_opcode == 0x00)
+		instruction = (opcode & 0xF83F) == 0x0000 ? &nop_instruction : &secondary_lut[opcode & 0x3F];
+	else if ((primary_opcode & 0x30) == 0x20)
+		instruction = &memory_luts[bus_policy][primary_opcode & 0xF];
+
+	DecodedInstruction decoded;
+	decoded.execute = instruction->execute;
+	decoded.ibf = InstructionBitField(opcode);
+	decoded.cycles = instruction->cycles;
+
+	return decoded;
+}
+
+void Cpu::fuse(DecodedInstruction& instruction, u32 address)
+{
+	//lui whose register only feeds the next instruction's base, the usual way
+	//to build a constant or an absolute address. The pair has to be on the
+	//same page so writing either one invalidates both
+	InstructionBitField& ibf = instruction.ibf;
+	if ((ibf.opcode >> 26) != 0x0F || ibf.rt() == 0 || ((address + 4) & (CODE_PAGE_SIZE - 1)) == 0)
+		return;
+
+	DecodedInstruction next = decode_at(address + 4);
+	if (next.ibf.rs() != ibf.rt())
+		return;
+
+	switch (next.ibf.opcode >> 26) {
+		case 0x09: instruction.execute = &Cpu::lui_addiu; break;
+		case 0x0D: instruction.execute = &Cpu::lui_ori; break;
+		case 0x23: instruction.execute = fused_loads[bus_policy]; break;
+		default: return;
+	}
+	ibf.register_d = next.ibf.rt();
+	ibf.immediate_sign_extended = next.ibf.immediate_se();
+	ibf.fused_cycles = next.cycles;
+}
+
+DecodedInstruction Cpu::unfuse(const DecodedInstruction& instruction)
+{
+	if (instruction.ibf.fused_cycles == 0)
+		return instruction;
+
+	DecodedInstruction lui = instruction;
+	lui.execute = &Cpu::lui;
+	lui.ibf = InstructionBitField(instruction.ibf.opcode);
+	return lui;
+}
+
+bool Cpu::is_branch(u32 opcode)
+{
+	u8 primary_opcode = (opcode >> 26) & 0x3F;
+	if (primary_opcode == 0x00) {
+		u8 secondary_opcode = opcode & 0x3F;
+		return secondary_opcode == 0x08 || secondary_opcode == 0x09; //jr, jalr
+	}
+
+	//bcond, j, jal, beq, bne, blez, bgtz
+	return primary_opcode >= 0x01 && primary_opcode <= 0x07;
+}
+
+bool Cpu::is_muldiv(u32 opcode)
+{
+	//mfhi, mthi, mflo, mtlo, mult, multu, div, divu
+	u8 secondary_opcode = opcode & 0x3F;
+	return (opcode >> 26) == 0x00 && ((secondary_opcode >= 0x10 && secondary_opcode <= 0x13) ||
+		(secondary_opcode >= 0x18 && secondary_opcode <= 0x1B));
+}
+
+bool Cpu::is_load(u32 opcode)
+{
+	//lb, lh, lwl, lw, lbu, lhu, lwr
+	u8 primary_opcode = (opcode >> 26) & 0x3F;
+	if (primary_opcode >= 0x20 && primary_opcode <= 0x26)
+		return true;
+
+	//mfc0 lands after a delay slot like the loads
+	return primary_opcode == 0x10 && ((opcode >> 21) & 0x1F) == 0x00;
 }
\ No newline at end of file
@@ -0,0 +1,776 @@
+#include "Recompiler.h"
+#include "Cpu.h"
+#include "Bus.h"
+#include <algorithm>
+#if defined(BUS_FASTMEM)
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
+#if defined(_WIN32)
+#define ARG0 RCX
+#define ARG1 RDX
+#define ARG2 R8
+#define ARG3 R9
+#else
+#define ARG0 RDI
+#define ARG1 RSI
+#define ARG2 RDX
+#define ARG3 RCX
+#endif
+
+#define FRAME_SIZE 32 //shadow space, with three pushes rsp stays aligned
+
+#if defined(BUS_FASTMEM)
+static std::vector<Recompiler*> fastmem_recompilers;
+static struct sigaction previous_segv_action;
+
+static void fastmem_fault_handler(int signal, siginfo_t* info, void* context)
+{
+	ucontext_t* ucontext = (ucontext_t*)context;
+	const u8* host_pc = (const u8*)ucontext->uc_mcontext.gregs[REG_RIP];
+
+	const u8* stub = Recompiler::handle_fault(host_pc);
+	if (stub != nullptr) {
+		ucontext->uc_mcontext.gregs[REG_RIP] = (greg_t)stub;
+		return;
+	}
+
+	//not a guest access, the fault repeats with whatever handled it before
+	sigaction(SIGSEGV, &previous_segv_action, nullptr);
+}
+#endif
+
+Recompiler::Recompiler(Cpu* cpu)
+	:cpu(cpu), bus(cpu->bus), enter(nullptr), exit(nullptr)
+{
+	pc_offset = (s32)((u8*)&cpu->pc - (u8*)cpu);
+	next_pc_offset = (s32)((u8*)&cpu->next_pc - (u8*)cpu);
+	current_pc_offset = (s32)((u8*)&cpu->current_pc - (u8*)cpu);
+	delay_slot_address_offset = (s32)((u8*)&cpu->delay_slot_address - (u8*)cpu);
+	load_delay_register_offset = (s32)((u8*)&cpu->load_delay_register - (u8*)cpu);
+	load_delay_value_offset = (s32)((u8*)&cpu->load_delay_value - (u8*)cpu);
+	downcount_offset = (s32)((u8*)&downcount - (u8*)cpu);
+	cycle_offset_offset = (s32)((u8*)&cpu->cycle_offset - (u8*)cpu);
+	downcount = 0;
+	budget = 0;
+	exit_carry = 0;
+
+	cpu->code_cache.set_invalidation_callback(&Recompiler::invalidate_page, this);
+
+	available = emitter.allocate(RECOMPILER_CODE_SIZE);
+	if (available)
+		emit_dispatcher();
+
+	fastmem = available && bus->fastmem_base != nullptr && install_fault_handler();
+#if defined(BUS_FASTMEM)
+	if (fastmem)
+		fastmem_recompilers.push_back(this);
+#endif
+}
+
+Recompiler::~Recompiler()
+{
+#if defined(BUS_FASTMEM)
+	fastmem_recompilers.erase(std::remove(fastmem_recompilers.begin(), fastmem_recompilers.end(), this),
+		fastmem_recompilers.end());
+#endif
+}
+
+bool Recompiler::install_fault_handler()
+{
+#if defined(BUS_FASTMEM)
+	static bool installed = false;
+	if (installed)
+		return true;
+
+	struct sigaction action = {};
+	action.sa_sigaction = &fastmem_fault_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, &previous_segv_action) != 0) {
+		printf("!!Failed to install the fastmem fault handler!!\n");
+		return false;
+	}
+
+	installed = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+const u8* Recompiler::handle_fault(const u8* host_pc)
+{
+#if defined(BUS_FASTMEM)
+	for (Recompiler* recompiler : fastmem_recompilers) {
+		auto it = recompiler->fastmem_stubs.find(host_pc);
+		if (it == recompiler->fastmem_stubs.end())
+			continue;
+
+		//the site faults again next time, go to the stub directly from now on
+		X64Emitter::patch_jmp((u8*)host_pc, it->second);
+		return it->second;
+	}
+#endif
+	return nullptr;
+}
+
+u32 Recompiler::execute(u32 cycle_budget)
+{
+	//linked blocks keep running until the budget is spent,
+	//we only come back here for blocks that are not compiled or linked yet
+	downcount = budget = (s32)cycle_budget;
+	exit_carry = 0;
+
+	if (!available)
+		return cpu->execute_block(cycle_budget);
+
+	while ((downcount + exit_carry) > 0) {
+		downcount += exit_carry;
+		exit_carry = 0;
+
+		//only ever set at a block boundary from here on
+		if (cpu->interrupt_pending)
+			cpu->take_interrupt();
+
+		if (emitter.free_space() < RECOMPILER_FLUSH_THRESHOLD)
+			flush();
+
+		//host code assumes sequential flow and no load in flight on entry,
+		//the delay slot of a branch or load that ended the last block runs interpreted.
+		//So does a misaligned jump target, whose fetch raises the address error
+		if (cpu->next_pc != cpu->pc + 4 || cpu->load_delay_register != 0 || (cpu->pc & 0x3) != 0) {
+			downcount -= cpu->clock();
+			continue;
+		}
+
+		BasicBlock* block = cpu->code_cache.lookup_block(cpu->pc);
+		if (block == nullptr) {
+			//blocks only exist for main ram and bios rom
+			if (cpu->code_cache.lookup(cpu->pc) == nullptr) {
+				downcount -= cpu->clock();
+				continue;
+			}
+			block = cpu->compile_block(cpu->pc);
+		}
+
+		if (block->code == nullptr) {
+			block->code = compile(block);
+			link_block(block);
+		}
+
+		s32 start = downcount;
+		enter(cpu, cpu->gprs, block->code);
+
+		//idle loops are never linked, every iteration comes back here
+		if (block->idle_loop && downcount > 0)
+			downcount -= (s32)cpu->skip_idle_loop(block, (u32)(start - downcount), (u32)downcount);
+	}
+
+	return (u32)elapsed();
+}
+
+u32 Recompiler::elapsed()
+{
+	return (u32)(budget - downcount - exit_carry);
+}
+
+void Recompiler::request_exit()
+{
+	//blocks leave once the downcount is spent, the rest is handed back after
+	exit_carry += downcount;
+	downcount = 0;
+}
+
+void Recompiler::flush()
+{
+	//every block may point into the buffer, drop them all
+	cpu->code_cache.reset();
+	interpreted.clear();
+	fastmem_stubs.clear();
+	for (std::vector<BlockLink>& page_links : links)
+		page_links.clear();
+	for (std::vector<s32>& pages : linked_pages)
+		pages.clear();
+
+	if (available) {
+		emitter.reset();
+		emit_dispatcher();
+	}
+
+	//watched or traced ram and scratchpad accesses have to go through the bus,
+	//everything else reaches it through the slow path anyway
+	direct_memory = fastmem && !bus->observed(0, 0x800000) && !bus->observed(0x1F800000, SCRATCHPAD_SIZE);
+}
+
+const u8* Recompiler::compile(BasicBlock* block)
+{
+	const u8* entry = emitter.current();
+
+	//whoever jumps here has already stored pc and next_pc
+	emitter.alu_m32_imm32(ALU_CMP, R12, downcount_offset, 0);
+	emitter.jcc_rel32(CC_LE, exit);
+	emitter.alu_m32_imm32(ALU_SUB, R12, downcount_offset, block->cycles);
+
+	compiling = block;
+	slow_paths.clear();
+	overflow_traps.clear();
+	exception_exits.clear();
+	u32 address = block->address;
+	u8 pending_load = 0; //target of a load in the previous instruction
+	size_t count = block->instructions.size();
+	for (size_t i = 0; i < count; i++, address += 4) {
+		DecodedInstruction& instruction = block->instructions[i];
+		if (Cpu::is_branch(instruction.ibf.opcode)) {
+			if ((i + 1) < count) {
+				emit_branch(instruction, address, block->instructions[i + 1], pending_load);
+			}
+			else {
+				//the delay slot is on the next page, the branch
+				//leaves its target in next_pc for the dispatcher
+				emitter.mov_m32_imm32(R12, next_pc_offset, address + 8);
+				emit_interpreted(instruction, address);
+				emit_exit();
+			}
+			emit_slow_paths();
+			return entry;
+		}
+
+		emit_instruction(instruction, address, pending_load);
+		pending_load = Cpu::is_load(instruction.ibf.opcode) ? instruction.ibf.rt() : 0;
+	}
+
+	//block ran to the end of its page
+	emit_linked_exit(block->address, address, pending_load == 0);
+	emit_slow_paths();
+
+	return entry;
+}
+
+void Recompiler::link_block(BasicBlock* block)
+{
+	for (BlockLink& link : links[CodeCache::page_index(block->address)]) {
+		if (link.target == block->address)
+			X64Emitter::patch_rel32(link.site, block->code);
+	}
+}
+
+void Recompiler::invalidate_page(void* context, s32 page)
+{
+	Recompiler* recompiler = (Recompiler*)context;
+
+	//exits into this page go back through the dispatcher until relinked
+	for (BlockLink& link : recompiler->links[page])
+		X64Emitter::patch_rel32(link.site, recompiler->exit);
+
+	//blocks on this page can no longer be entered, neither can their exits
+	for (s32 target_page : recompiler->linked_pages[page]) {
+		std::vector<BlockLink>& target_links = recompiler->links[target_page];
+		target_links.erase(std::remove_if(target_links.begin(), target_links.end(),
+			[page](const BlockLink& link) { return link.source_page == page; }), target_links.end());
+	}
+	recompiler->linked_pages[page].clear();
+}
+
+void Recompiler::emit_dispatcher()
+{
+	//three pushes and the frame keep rsp 16 byte aligned for calls
+	enter = (void (*)(Cpu*, u32*, const u8*))emitter.current();
+	emitter.push_r64(RBX);
+	emitter.push_r64(R12);
+	emitter.push_r64(R15);
+	emitter.sub_rsp_imm8(FRAME_SIZE);
+	emitter.mov_r64_r64(R12, ARG0);
+	emitter.mov_r64_r64(RBX, ARG1);
+	emitter.mov_r64_imm64(R15, (u64)bus->fastmem_base);
+	emitter.jmp_r64(ARG2);
+
+	exit = emitter.current();
+	emitter.add_rsp_imm8(FRAME_SIZE);
+	emitter.pop_r64(R15);
+	emitter.pop_r64(R12);
+	emitter.pop_r64(RBX);
+	emitter.ret();
+}
+
+void Recompiler::emit_instruction(DecodedInstruction& instruction, u32 address, u8 pending_load)
+{
+	//nops only retire the load in flight
+	if (instruction.execute == &Cpu::nop) {
+		if (pending_load != 0)
+			emit_load_delay(pending_load, 0);
+		return;
+	}
+
+	if (emit_alu_immediate(instruction, address)) {
+		if (pending_load != 0)
+			emit_load_delay(pending_load, instruction.ibf.rt());
+		return;
+	}
+
+	if (direct_memory && emit_load_store(instruction, address, pending_load))
+		return;
+
+	//the interpreter retires loads itself
+	emit_interpreted(instruction, address);
+}
+
+void Recompiler::emit_interpreted(DecodedInstruction& instruction, u32 address)
+{
+	//keep pc where the interpreter expects it
+	emitter.mov_m32_imm32(R12, pc_offset, address + 4);
+	emitter.mov_m32_imm32(R12, current_pc_offset, address);
+
+	//the block charged this instruction and the rest on entry, the
+	//multiply/divide unit and the tracer want the issue cycle
+	bool timed = Cpu::is_muldiv(instruction.ibf.opcode) || (cpu->bus_policy & BUS_TRACING) != 0;
+	if (timed)
+		emitter.mov_m32_imm32(R12, cycle_offset_offset, (u32)-cycles_ahead(address));
+
+	interpreted.push_back(instruction);
+	emitter.mov_r64_r64(ARG0, R12);
+	emitter.mov_r64_imm64(ARG1, (u64)&interpreted.back());
+	emitter.mov_r64_imm64(RAX, (u64)&Recompiler::interpret);
+	emitter.call_r64(RAX);
+
+	if (timed)
+		emitter.mov_m32_imm32(R12, cycle_offset_offset, 0);
+
+	//an exception moved pc to its vector, the rest of the block is skipped
+	emitter.alu_m32_imm32(ALU_CMP, R12, pc_offset, address + 4);
+	exception_exits.push_back(ExceptionExit{ emitter.jcc_rel32(CC_NE, exit), address });
+}
+
+void Recompiler::emit_branch(DecodedInstruction& branch, u32 address, DecodedInstruction& delay_slot, u8 pending_load)
+{
+	InstructionBitField& ibf = branch.ibf;
+	u8 primary_opcode = (ibf.opcode >> 26) & 0x3F;
+	u32 delay_slot_address = address + 4;
+	u32 return_address = address + 8;
+
+	//a load in the delay slot is still in flight at the exits,
+	//the dispatcher has to run the next instruction
+	bool linkable = !Cpu::is_load(delay_slot.ibf.opcode);
+
+	//lets an exception in the delay slot report the branch
+	emitter.mov_m32_imm32(R12, delay_slot_address_offset, delay_slot_address);
+
+	//j, jal have a static target
+	if (primary_opcode == 0x02 || primary_opcode == 0x03) {
+		u32 target = (delay_slot_address & 0xF0000000) | (ibf.immediate_26() << 2);
+		if (primary_opcode == 0x03)
+			emitter.mov_m32_imm32(RBX, register_offset(RA), return_address);
+		if (pending_load != 0)
+			emit_load_delay(pending_load, primary_opcode == 0x03 ? RA : 0);
+
+		emit_instruction(delay_slot, delay_slot_address, 0);
+		emit_linked_exit(address, target, linkable);
+		return;
+	}
+
+	//the target goes to next_pc before the delay slot can change its inputs
+	emitter.mov_r32_m32(RAX, RBX, register_offset(ibf.rs()));
+	if (primary_opcode == 0x00) {
+		//jr, jalr
+		emitter.mov_m32_r32(R12, next_pc_offset, RAX);
+		bool link = (ibf.opcode & 0x3F) == 0x09;
+		if (link && ibf.rd() != 0)
+			emitter.mov_m32_imm32(RBX, register_offset(ibf.rd()), return_address);
+		if (pending_load != 0)
+			emit_load_delay(pending_load, link ? ibf.rd() : 0);
+
+		emit_instruction(delay_slot, delay_slot_address, 0);
+		emitter.mov_r32_m32(RAX, R12, next_pc_offset);
+		emitter.mov_m32_r32(R12, pc_offset, RAX);
+		emitter.alu_r32_imm32(ALU_ADD, RAX, 4);
+		emitter.mov_m32_r32(R12, next_pc_offset, RAX);
+		emit_exit();
+	}
+	else {
+		u32 target = delay_slot_address + (ibf.immediate_se() << 2);
+		X64Condition condition = CC_E;
+		bool link = false;
+		bool never_taken = false;
+
+		switch (primary_opcode) {
+			case 0x01: {
+				emitter.test_r32_r32(RAX, RAX);
+				switch (ibf.rt()) {
+					case 0b00000: condition = CC_L; break; //bltz
+					case 0b00001: condition = CC_GE; break; //bgez
+					case 0b10000: condition = CC_L; link = true; break; //bltzal
+					case 0b10001: condition = CC_GE; link = true; break; //bgezal
+					default: never_taken = true; break;
+				}
+			}
+			break;
+			case 0x04: emitter.cmp_r32_m32(RAX, RBX, register_offset(ibf.rt())); condition = CC_E; break;
+			case 0x05: emitter.cmp_r32_m32(RAX, RBX, register_offset(ibf.rt())); condition = CC_NE; break;
+			case 0x06: emitter.test_r32_r32(RAX, RAX); condition = CC_LE; break;
+			case 0x07: emitter.test_r32_r32(RAX, RAX); condition = CC_G; break;
+		}
+
+		emitter.mov_r32_imm32(RCX, return_address);
+		if (!never_taken) {
+			emitter.mov_r32_imm32(RDX, target);
+			emitter.cmovcc_r32_r32(condition, RCX, RDX);
+		}
+		emitter.mov_m32_r32(R12, next_pc_offset, RCX);
+
+		if (link)
+			emitter.mov_m32_imm32(RBX, register_offset(RA), return_address);
+		if (pending_load != 0)
+			emit_load_delay(pending_load, link ? RA : 0);
+
+		emit_instruction(delay_slot, delay_slot_address, 0);
+		if (!never_taken) {
+			//both successors are static, each gets its own linkable exit
+			emitter.alu_m32_imm32(ALU_CMP, R12, next_pc_offset, target);
+			u8* not_taken = emitter.jcc_rel32(CC_NE, emitter.current());
+			emit_linked_exit(address, target, linkable);
+			X64Emitter::patch_rel32(not_taken, emitter.current());
+		}
+		emit_linked_exit(address, return_address, linkable);
+	}
+}
+
+void Recompiler::emit_load_delay(u8 load_register, u8 written_register)
+{
+	//the load lands once its delay slot ran natively,
+	//unless the slot wrote the same register
+	if (written_register != load_register) {
+		emitter.mov_r32_m32(RAX, R12, load_delay_value_offset);
+		emitter.mov_m32_r32(RBX, register_offset(load_register), RAX);
+	}
+	emitter.mov_m8_imm8(R12, load_delay_register_offset, 0);
+}
+
+void Recompiler::emit_exit()
+{
+	emitter.jmp_rel32(exit);
+}
+
+void Recompiler::emit_linked_exit(u32 source, u32 target, bool linkable)
+{
+	emitter.mov_m32_imm32(R12, pc_offset, target);
+	emitter.mov_m32_imm32(R12, next_pc_offset, target + 4);
+	u8* site = emitter.jmp_rel32(exit);
+
+	//targets outside the code cache always go through the dispatcher,
+	//so do idle loops to be skipped there
+	s32 target_page = CodeCache::page_index(target);
+	if (!linkable || target_page < 0 || compiling->idle_loop)
+		return;
+
+	s32 source_page = CodeCache::page_index(source);
+	links[target_page].push_back(BlockLink{ target, site, source_page });
+
+	std::vector<s32>& pages = linked_pages[source_page];
+	if (std::find(pages.begin(), pages.end(), target_page) == pages.end())
+		pages.push_back(target_page);
+
+	BasicBlock* block = cpu->code_cache.lookup_block(target);
+	if (block != nullptr && block->code != nullptr)
+		X64Emitter::patch_rel32(site, block->code);
+}
+
+bool Recompiler::emit_alu_immediate(DecodedInstruction& instruction, u32 address)
+{
+	InstructionBitField& ibf = instruction.ibf;
+	u8 primary_opcode = (ibf.opcode >> 26) & 0x3F;
+	if (primary_opcode < 0x08 || primary_opcode > 0x0F)
+		return false;
+
+	//writes to $zero are discarded, addi can still trap
+	if (ibf.rt() == 0)
+		return primary_opcode != 0x08;
+
+	if (primary_opcode == 0x0F) { //lui
+		emitter.mov_m32_imm32(RBX, register_offset(ibf.rt()), ibf.immediate_16() << 16);
+		return true;
+	}
+
+	emitter.mov_r32_m32(RAX, RBX, register_offset(ibf.rs()));
+	switch (primary_opcode) {
+		case 0x08: {
+			//rt is only written when the add did not overflow
+			emitter.alu_r32_imm32(ALU_ADD, RAX, ibf.immediate_se());
+			overflow_traps.push_back({ emitter.jcc_rel32(CC_O, emitter.current()), address });
+		}
+		break;
+		case 0x09: emitter.alu_r32_imm32(ALU_ADD, RAX, ibf.immediate_se()); break;
+		case 0x0A: {
+			emitter.alu_r32_imm32(ALU_CMP, RAX, ibf.immediate_se());
+			emitter.setcc_r8(CC_L, RAX);
+			emitter.movzx_r32_r8(RAX, RAX);
+		}
+		break;
+		case 0x0B: {
+			emitter.alu_r32_imm32(ALU_CMP, RAX, ibf.immediate_se());
+			emitter.setcc_r8(CC_B, RAX);
+			emitter.movzx_r32_r8(RAX, RAX);
+		}
+		break;
+		case 0x0C: emitter.alu_r32_imm32(ALU_AND, RAX, ibf.immediate_16()); break;
+		case 0x0D: emitter.alu_r32_imm32(ALU_OR, RAX, ibf.immediate_16()); break;
+		case 0x0E: emitter.alu_r32_imm32(ALU_XOR, RAX, ibf.immediate_16()); break;
+	}
+	emitter.mov_m32_r32(RBX, register_offset(ibf.rt()), RAX);
+
+	return true;
+}
+
+bool Recompiler::emit_load_store(DecodedInstruction& instruction, u32 address, u8 pending_load)
+{
+	InstructionBitField& ibf = instruction.ibf;
+	u8 primary_opcode = (ibf.opcode >> 26) & 0x3F;
+
+	X64Width width;
+	bool sign_extend = false;
+	bool store = false;
+	switch (primary_opcode) {
+		case 0x20: width = WIDTH_8; sign_extend = true; break; //lb
+		case 0x21: width = WIDTH_16; sign_extend = true; break; //lh
+		case 0x23: width = WIDTH_32; break; //lw
+		case 0x24: width = WIDTH_8; break; //lbu
+		case 0x25: width = WIDTH_16; break; //lhu
+		case 0x28: width = WIDTH_8; store = true; break; //sb
+		case 0x29: width = WIDTH_16; store = true; break; //sh
+		case 0x2B: width = WIDTH_32; store = true; break; //sw
+		default: return false; //lwl, lwr, swl, swr and coprocessor transfers stay interpreted
+	}
+
+	//operands are read before the previous load lands
+	emitter.mov_r32_m32(RCX, RBX, register_offset(ibf.rs()));
+	emitter.alu_r32_imm32(ALU_ADD, RCX, ibf.immediate_se());
+	if (store)
+		emitter.mov_r32_m32(RDX, RBX, register_offset(ibf.rt()));
+
+	FastmemAccess access;
+	access.address = address;
+	access.opcode = primary_opcode;
+	access.unaligned = nullptr;
+	if (width != WIDTH_8) {
+		emitter.test_r32_imm32(RCX, width == WIDTH_16 ? 1 : 3);
+		access.unaligned = emitter.jcc_rel32(CC_NE, emitter.current());
+	}
+
+	access.site = emitter.current();
+	if (store)
+		emitter.store_indexed(width, R15, RCX, RDX);
+	else
+		emitter.load_indexed(width, sign_extend, RAX, R15, RCX);
+	u32 length = (u32)(emitter.current() - access.site);
+	if (length < 5)
+		emitter.nop(5 - length);
+
+	if (store) {
+		emit_code_page_check();
+		access.resume = emitter.current();
+		slow_paths.push_back(access);
+
+		if (pending_load != 0)
+			emit_load_delay(pending_load, 0);
+		return true;
+	}
+
+	access.resume = emitter.current();
+	slow_paths.push_back(access);
+
+	//same as update_load_delay, the previous load lands unless this one replaces it
+	if (pending_load != 0 && pending_load != ibf.rt()) {
+		emitter.mov_r32_m32(RDX, R12, load_delay_value_offset);
+		emitter.mov_m32_r32(RBX, register_offset(pending_load), RDX);
+	}
+	emitter.mov_m32_r32(R12, load_delay_value_offset, RAX);
+	emitter.mov_m8_imm8(R12, load_delay_register_offset, ibf.rt());
+
+	return true;
+}
+
+void Recompiler::emit_code_page_check()
+{
+	//same test as the bus does on its writes, only pages holding code get invalidated
+	emitter.mov_r32_r32(RAX, RCX);
+	emitter.alu_r32_imm32(ALU_AND, RAX, 0x1FFFFFFF);
+	emitter.alu_r32_imm32(ALU_CMP, RAX, 0x800000);
+	u8* not_ram = emitter.jcc_rel32(CC_AE, emitter.current());
+
+	emitter.alu_r32_imm32(ALU_AND, RAX, MAIN_RAM_SIZE - 1);
+	emitter.shr_r32_imm8(RAX, CODE_PAGE_SHIFT);
+	emitter.mov_r64_imm64(RDX, (u64)bus->code_pages.data());
+	emitter.bt_m32_r32(RDX, RAX);
+	u8* no_code = emitter.jcc_rel32(CC_AE, emitter.current());
+
+	emitter.mov_r32_r32(ARG1, RCX);
+	emitter.mov_r64_imm64(ARG0, (u64)bus);
+	emitter.mov_r64_imm64(RAX, (u64)&Recompiler::check_code_page);
+	emitter.call_r64(RAX);
+
+	X64Emitter::patch_rel32(not_ram, emitter.current());
+	X64Emitter::patch_rel32(no_code, emitter.current());
+}
+
+void Recompiler::emit_slow_paths()
+{
+	//the policy can only change with a flush, which drops this code too
+	static u32 (*const slow_loads[BUS_POLICY_COUNT])(Cpu*, u32, u32) = {
+		&Recompiler::slow_load<BUS_PLAIN>,
+		&Recompiler::slow_load<BUS_WATCHPOINTS>,
+		&Recompiler::slow_load<BUS_TRACING>,
+		&Recompiler::slow_load<BUS_WATCHPOINTS | BUS_TRACING>
+	};
+	static void (*const slow_stores[BUS_POLICY_COUNT])(Cpu*, u32, u32, u32) = {
+		&Recompiler::slow_store<BUS_PLAIN>,
+		&Recompiler::slow_store<BUS_WATCHPOINTS>,
+		&Recompiler::slow_store<BUS_TRACING>,
+		&Recompiler::slow_store<BUS_WATCHPOINTS | BUS_TRACING>
+	};
+
+	//out of line after the block, reached once the access site faulted and was patched
+	for (FastmemAccess& access : slow_paths) {
+		u8* stub = emitter.current();
+		fastmem_stubs[access.site] = stub;
+		emitter.mov_m32_imm32(R12, current_pc_offset, access.address); //for the tracer
+		bool traced = (cpu->bus_policy & BUS_TRACING) != 0;
+		if (traced)
+			emitter.mov_m32_imm32(R12, cycle_offset_offset, (u32)-cycles_ahead(access.address));
+
+		//argument registers overlap ecx and edx, copy them in this order
+		if (access.opcode >= 0x28) {
+			emitter.mov_r32_r32(ARG2, RDX);
+			emitter.mov_r32_r32(ARG1, RCX);
+			emitter.mov_r64_r64(ARG0, R12);
+			emitter.mov_r32_imm32(ARG3, access.opcode);
+			emitter.mov_r64_imm64(RAX, (u64)slow_stores[cpu->bus_policy]);
+		}
+		else {
+			emitter.mov_r32_r32(ARG1, RCX);
+			emitter.mov_r64_r64(ARG0, R12);
+			emitter.mov_r32_imm32(ARG2, access.opcode);
+			emitter.mov_r64_imm64(RAX, (u64)slow_loads[cpu->bus_policy]);
+		}
+		emitter.call_r64(RAX);
+		if (traced)
+			emitter.mov_m32_imm32(R12, cycle_offset_offset, 0);
+		emitter.jmp_rel32(access.resume);
+
+		//misaligned addresses raise an address error and leave the block
+		if (access.unaligned != nullptr) {
+			X64Emitter::patch_rel32(access.unaligned, emitter.current());
+			emitter.mov_r32_r32(ARG1, RCX);
+			emitter.mov_r64_r64(ARG0, R12);
+			emitter.mov_r32_imm32(ARG2, access.address);
+			emitter.mov_r32_imm32(ARG3, access.opcode);
+			emitter.mov_r64_imm64(RAX, (u64)&Recompiler::raise_address_error);
+			emitter.call_r64(RAX);
+			emit_refund(access.address);
+			emit_exit();
+		}
+	}
+	slow_paths.clear();
+
+	for (OverflowTrap& trap : overflow_traps) {
+		X64Emitter::patch_rel32(trap.site, emitter.current());
+		emitter.mov_r64_r64(ARG0, R12);
+		emitter.mov_r32_imm32(ARG1, trap.address);
+		emitter.mov_r64_imm64(RAX, (u64)&Recompiler::raise_overflow);
+		emitter.call_r64(RAX);
+		emit_refund(trap.address);
+		emit_exit();
+	}
+	overflow_traps.clear();
+
+	for (ExceptionExit& exception_exit : exception_exits) {
+		X64Emitter::patch_rel32(exception_exit.site, emitter.current());
+		emit_refund(exception_exit.address);
+		emit_exit();
+	}
+	exception_exits.clear();
+}
+
+void Recompiler::emit_refund(u32 address)
+{
+	//the block charged every instruction on entry, the interpreter
+	//would not have run the ones after an exception
+	s32 cycles = cycles_ahead(address + 4);
+	if (cycles != 0)
+		emitter.alu_m32_imm32(ALU_ADD, R12, downcount_offset, (u32)cycles);
+}
+
+void Recompiler::interpret(Cpu* cpu, DecodedInstruction* instruction)
+{
+	cpu->execute(*instruction);
+	cpu->recompiler.charge_stall_cycles();
+}
+
+template <u8 Policy>
+u32 Recompiler::slow_load(Cpu* cpu, u32 address, u32 opcode)
+{
+	u32 value;
+	switch (opcode) {
+		case 0x20: value = (u32)(s8)cpu->load<Policy, u8>(address); break;
+		case 0x21: value = (u32)(s16)cpu->load<Policy, u16>(address); break;
+		case 0x24: value = cpu->load<Policy, u8>(address); break;
+		case 0x25: value = cpu->load<Policy, u16>(address); break;
+		default: value = cpu->load<Policy, u32>(address); break;
+	}
+	cpu->recompiler.charge_stall_cycles();
+	return value;
+}
+
+template <u8 Policy>
+void Recompiler::slow_store(Cpu* cpu, u32 address, u32 value, u32 opcode)
+{
+	switch (opcode) {
+		case 0x28: cpu->store<Policy, u8>(address, (u8)value); break;
+		case 0x29: cpu->store<Policy, u16>(address, (u16)value); break;
+		default: cpu->store<Policy, u32>(address, value); break;
+	}
+	cpu->recompiler.charge_stall_cycles();
+}
+
+void Recompiler::charge_stall_cycles()
+{
+	//taken from the downcount right away so linked blocks see them too
+	downcount -= (s32)cpu->stall_cycles;
+	cpu->stall_cycles = 0;
+}
+
+s32 Recompiler::cycles_ahead(u32 address)
+{
+	s32 cycles = 0;
+	for (size_t i = (address - compiling->address) / 4; i < compiling->instructions.size(); i++)
+		cycles += compiling->instructions[i].cycles;
+	return cycles;
+}
+
+void Recompiler::check_code_page(Bus* bus, u32 address)
+{
+	bus->check_code_page(address & 0x1FFFFFFF);
+}
+
+void Recompiler::raise_address_error(Cpu* cpu, u32 address, u32 instruction_address, u32 opcode)
+{
+	cpu->current_pc = instruction_address;
+	cpu->address_error(opcode >= 0x28 ? ExceptionCause::AddressErrorStore : ExceptionCause::AddressErrorLoad, address);
+
+	//like the interpreter, the load issued before the faulting instruction still lands
+	if (cpu->load_delay_register != 0)
+		cpu->update_load_delay();
+}
+
+void Recompiler::raise_overflow(Cpu* cpu, u32 instruction_address)
+{
+	cpu->current_pc = instruction_address;
+	cpu->raise_exception(ExceptionCause::Overflow);
+
+	if (cpu->load_delay_register != 0)
+		cpu->update_load_delay();
+}
+
+s32 Recompiler::register_offset(u8 register_index)
+{
+	return register_index * sizeof(u32);
+}
\ No newline at end of file
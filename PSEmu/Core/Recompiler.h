@@ -0,0 +1,133 @@
+#pragma once
+#include "Common.h"
+#include "Emitter.h"
+#include "CodeCache.h"
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+#define RECOMPILER_CODE_SIZE (32 * 1024 * 1024)
+//worst case host bytes for the largest block (a full page), flush before it may not fit
+#define RECOMPILER_FLUSH_THRESHOLD (256 * 1024)
+
+struct Cpu;
+struct Bus;
+struct BasicBlock;
+struct DecodedInstruction;
+
+//exit of a block with a static target, patched to jump straight into the
+//target block once it is compiled and back to the dispatcher when it goes away
+struct BlockLink {
+	u32 target;
+	u8* site; //rel32 of the exit jump
+	s32 source_page;
+};
+
+//guest load or store done straight on the fastmem arena, anything that is not
+//ram or scratchpad faults at site and continues in a stub calling the bus
+struct FastmemAccess {
+	u8* site; //host access, at least 5 bytes so a jump to the stub fits
+	u8* resume; //first instruction after the access
+	u8* unaligned; //rel32 of the alignment check to the address error stub, nullptr for bytes
+	u32 address; //of the guest instruction
+	u8 opcode; //primary opcode of the guest instruction
+};
+
+//jo after a trapping add, the stub raises the overflow exception
+struct OverflowTrap {
+	u8* site; //rel32 of the jo
+	u32 address; //of the guest instruction
+};
+
+//leaves the block once an interpreted instruction raised an exception
+struct ExceptionExit {
+	u8* site; //rel32 of the jne
+	u32 address; //of the guest instruction
+};
+
+//x86-64 backend for the cached basic blocks. Host code works directly on
+//the Cpu register file, so execution can switch between the interpreter
+//and recompiled blocks at any block boundary.
+//
+//Register usage inside blocks:
+//rbx = &cpu->gprs[0], r12 = cpu, r15 = fastmem base
+//ecx holds the guest address and edx the store value around memory accesses
+struct Recompiler {
+	Recompiler(Cpu* cpu);
+	~Recompiler();
+
+	u32 execute(u32 cycle_budget);
+	const u8* compile(BasicBlock* block);
+	void flush();
+	void request_exit(); //linked blocks return to the dispatcher at the next block boundary
+	u32 elapsed(); //cycles charged so far by the current execute, blocks charge on entry
+
+	//called from the SIGSEGV handler, returns the stub for a faulting access site
+	static const u8* handle_fault(const u8* host_pc);
+
+private:
+	void emit_dispatcher();
+	void emit_instruction(DecodedInstruction& instruction, u32 address, u8 pending_load);
+	void emit_interpreted(DecodedInstruction& instruction, u32 address);
+	void emit_branch(DecodedInstruction& branch, u32 address, DecodedInstruction& delay_slot, u8 pending_load);
+	void emit_load_delay(u8 load_register, u8 written_register);
+	void emit_exit();
+	void emit_linked_exit(u32 source, u32 target, bool linkable);
+
+	bool emit_alu_immediate(DecodedInstruction& instruction, u32 address);
+	bool emit_load_store(DecodedInstruction& instruction, u32 address, u8 pending_load);
+	void emit_code_page_check();
+	void emit_slow_paths();
+	void emit_refund(u32 address); //gives back what the block charged past the instruction at address
+
+	void link_block(BasicBlock* block);
+	static void invalidate_page(void* context, s32 page);
+	static void interpret(Cpu* cpu, DecodedInstruction* instruction);
+	template <u8 Policy> static u32 slow_load(Cpu* cpu, u32 address, u32 opcode);
+	template <u8 Policy> static void slow_store(Cpu* cpu, u32 address, u32 value, u32 opcode);
+	void charge_stall_cycles();
+	s32 cycles_ahead(u32 address); //charged on entry for the instruction at address and the rest of the block
+	static void check_code_page(Bus* bus, u32 address);
+	static void raise_address_error(Cpu* cpu, u32 address, u32 instruction_address, u32 opcode);
+	static void raise_overflow(Cpu* cpu, u32 instruction_address);
+	static bool install_fault_handler();
+
+	s32 register_offset(u8 register_index);
+
+	Cpu* cpu;
+	Bus* bus;
+	X64Emitter emitter;
+	bool available;
+	bool fastmem; //loads and stores go through the arena instead of the interpreter
+	bool direct_memory = false; //fastmem, and no watchpoint or trace range covers ram or scratchpad
+
+	//enter(cpu, gprs, code) jumps into a block, blocks leave through exit
+	void (*enter)(Cpu* cpu, u32* gprs, const u8* code);
+	const u8* exit;
+	s32 pc_offset; //offset of Cpu::pc from the cpu pointer
+	s32 next_pc_offset;
+	s32 current_pc_offset;
+	s32 delay_slot_address_offset;
+	s32 load_delay_register_offset;
+	s32 load_delay_value_offset;
+	s32 downcount_offset;
+	s32 cycle_offset_offset;
+
+	//cycles left before linked blocks return to the dispatcher,
+	//every block subtracts its cost on entry
+	s32 downcount;
+	s32 budget; //of the current execute
+	s32 exit_carry; //budget set aside by request_exit, returned by the dispatcher
+
+	//interpreted instructions referenced by host code, kept until the next flush
+	std::deque<DecodedInstruction> interpreted;
+
+	const BasicBlock* compiling = nullptr;
+	std::vector<FastmemAccess> slow_paths; //of the block being compiled
+	std::vector<OverflowTrap> overflow_traps; //of the block being compiled
+	std::vector<ExceptionExit> exception_exits; //of the block being compiled
+	std::unordered_map<const u8*, const u8*> fastmem_stubs; //stub by access site, kept until the next flush
+
+	std::array<std::vector<BlockLink>, CODE_CACHE_PAGES> links; //by target page
+	std::array<std::vector<s32>, CODE_CACHE_PAGES> linked_pages; //target pages by source page
+};
\ No newline at end of file